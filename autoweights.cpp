@@ -0,0 +1,380 @@
+// Vertex Skinning
+// Automatic skin weights from bone segments, with an on-disk cache.
+
+#include "autoweights.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SKIN_WEIGHTS_MAGIC   0x54575356 // "VSWT"
+#define SKIN_WEIGHTS_VERSION 1
+
+// Uniform grid of cubic cells; each cell lists the bones whose bounding box overlaps it
+class BoneGrid {
+public:
+	float origin[3];
+	float cellSize;
+	int size[3];
+	int* cellStart; // size[0]*size[1]*size[2] + 1 offsets into cellBones
+	int* cellBones;
+};
+
+static void cellOf(const BoneGrid* grid, const float* p, int* cell)
+{
+	for(int a = 0; a < 3; a++) {
+		int c = (int) floor((p[a] - grid->origin[a]) / grid->cellSize);
+		if(c < 0) c = 0;
+		if(c >= grid->size[a]) c = grid->size[a] - 1;
+		cell[a] = c;
+	}
+}
+
+// Bone segment a..b with the direction and inverse squared length precomputed
+class BoneSegment {
+public:
+	float a[3];
+	float ab[3];
+	float inverseLengthSquared;
+};
+
+static float segmentDistanceSquared(const float* p, const BoneSegment* segment)
+{
+	float ap[3] = {p[0] - segment->a[0], p[1] - segment->a[1], p[2] - segment->a[2]};
+	float t = (ap[0] * segment->ab[0] + ap[1] * segment->ab[1] + ap[2] * segment->ab[2]) * segment->inverseLengthSquared;
+	if(t < 0.0f) t = 0.0f;
+	if(t > 1.0f) t = 1.0f;
+	float d[3] = {ap[0] - t * segment->ab[0], ap[1] - t * segment->ab[1], ap[2] - t * segment->ab[2]};
+	return d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+}
+
+// squared distance from p to the box of the given cell
+static float cellDistanceSquared(const BoneGrid* grid, const float* p, int x, int y, int z)
+{
+	int cell[3] = {x, y, z};
+	float distance = 0.0f;
+	for(int a = 0; a < 3; a++) {
+		float lo = grid->origin[a] + cell[a] * grid->cellSize;
+		float d = 0.0f;
+		if(p[a] < lo) d = lo - p[a];
+		else if(p[a] > lo + grid->cellSize) d = p[a] - lo - grid->cellSize;
+		distance += d * d;
+	}
+	return distance;
+}
+
+static BoneGrid* createBoneGrid(const float* positions, int vertexCount,
+								const float* boneStarts, const float* boneEnds, int boneCount)
+{
+	float lo[3] = {1e30f, 1e30f, 1e30f};
+	float hi[3] = {-1e30f, -1e30f, -1e30f};
+	for(int i = 0; i < vertexCount; i++) {
+		for(int a = 0; a < 3; a++) {
+			if(positions[i * 3 + a] < lo[a]) lo[a] = positions[i * 3 + a];
+			if(positions[i * 3 + a] > hi[a]) hi[a] = positions[i * 3 + a];
+		}
+	}
+	for(int i = 0; i < boneCount * 3; i++) {
+		int a = i % 3;
+		if(boneStarts[i] < lo[a]) lo[a] = boneStarts[i];
+		if(boneStarts[i] > hi[a]) hi[a] = boneStarts[i];
+		if(boneEnds[i] < lo[a]) lo[a] = boneEnds[i];
+		if(boneEnds[i] > hi[a]) hi[a] = boneEnds[i];
+	}
+
+	// about one bone per cell: finer cells shorten the lists, but the K-th nearest bone is
+	// often several rings away and every empty cell on the way costs a box test
+	int resolution = (int) ceil(cbrt((double) boneCount));
+	if(resolution < 1) resolution = 1;
+	if(resolution > 64) resolution = 64;
+	float extent = 0.0f;
+	for(int a = 0; a < 3; a++) {
+		if(hi[a] - lo[a] > extent) extent = hi[a] - lo[a];
+	}
+	if(extent <= 0.0f) extent = 1.0f;
+
+	BoneGrid* grid = new BoneGrid();
+	grid->cellSize = extent / resolution;
+	int cellCount = 1;
+	for(int a = 0; a < 3; a++) {
+		grid->origin[a] = lo[a];
+		grid->size[a] = (int) ceil((hi[a] - lo[a]) / grid->cellSize);
+		if(grid->size[a] < 1) grid->size[a] = 1;
+		cellCount *= grid->size[a];
+	}
+
+	// count, prefix sum, fill
+	grid->cellStart = (int *) calloc(cellCount + 1, sizeof(int));
+	int lower[3], upper[3];
+	for(int pass = 0; pass < 2; pass++) {
+		int* fill = NULL;
+		if(pass == 1) {
+			for(int c = 0; c < cellCount; c++) {
+				grid->cellStart[c + 1] += grid->cellStart[c];
+			}
+			grid->cellBones = (int *) malloc(grid->cellStart[cellCount] * sizeof(int));
+			fill = (int *) calloc(cellCount, sizeof(int));
+		}
+		for(int b = 0; b < boneCount; b++) {
+			float bmin[3], bmax[3];
+			for(int a = 0; a < 3; a++) {
+				bmin[a] = fmin(boneStarts[b * 3 + a], boneEnds[b * 3 + a]);
+				bmax[a] = fmax(boneStarts[b * 3 + a], boneEnds[b * 3 + a]);
+			}
+			cellOf(grid, bmin, lower);
+			cellOf(grid, bmax, upper);
+			for(int z = lower[2]; z <= upper[2]; z++) {
+				for(int y = lower[1]; y <= upper[1]; y++) {
+					for(int x = lower[0]; x <= upper[0]; x++) {
+						int c = (z * grid->size[1] + y) * grid->size[0] + x;
+						if(pass == 0) {
+							grid->cellStart[c + 1]++;
+						} else {
+							grid->cellBones[grid->cellStart[c] + fill[c]++] = b;
+						}
+					}
+				}
+			}
+		}
+		free(fill);
+	}
+	return grid;
+}
+
+static void freeBoneGrid(BoneGrid* grid)
+{
+	free(grid->cellStart);
+	free(grid->cellBones);
+	delete grid;
+}
+
+// keeps the K closest bones seen so far, sorted by distance
+static void insertCandidate(float* bestDistance, int* bestBone, int influences, float distance, int bone)
+{
+	if(distance >= bestDistance[influences - 1]) {
+		return;
+	}
+	int i = influences - 1;
+	while(i > 0 && bestDistance[i - 1] > distance) {
+		bestDistance[i] = bestDistance[i - 1];
+		bestBone[i] = bestBone[i - 1];
+		i--;
+	}
+	bestDistance[i] = distance;
+	bestBone[i] = bone;
+}
+
+SkinWeights* computeSkinWeights(const float* positions, int vertexCount,
+								const float* boneStarts, const float* boneEnds, int boneCount,
+								int influences, float falloff)
+{
+	if(influences > MAX_INFLUENCES) influences = MAX_INFLUENCES;
+	if(influences > boneCount) influences = boneCount;
+	if(influences <= 0 || vertexCount < 0) {
+		return NULL;
+	}
+
+	SkinWeights* skinWeights = new SkinWeights();
+	skinWeights->vertexCount = vertexCount;
+	skinWeights->influences = influences;
+	skinWeights->bones = (int *) malloc(vertexCount * influences * sizeof(int));
+	skinWeights->weights = (float *) malloc(vertexCount * influences * sizeof(float));
+
+	BoneGrid* grid = createBoneGrid(positions, vertexCount, boneStarts, boneEnds, boneCount);
+	BoneSegment* segments = (BoneSegment *) malloc(boneCount * sizeof(BoneSegment));
+	for(int b = 0; b < boneCount; b++) {
+		float lengthSquared = 0.0f;
+		for(int a = 0; a < 3; a++) {
+			segments[b].a[a] = boneStarts[b * 3 + a];
+			segments[b].ab[a] = boneEnds[b * 3 + a] - boneStarts[b * 3 + a];
+			lengthSquared += segments[b].ab[a] * segments[b].ab[a];
+		}
+		segments[b].inverseLengthSquared = lengthSquared > 0.0f ? 1.0f / lengthSquared : 0.0f;
+	}
+	int maxRing = grid->size[0];
+	if(grid->size[1] > maxRing) maxRing = grid->size[1];
+	if(grid->size[2] > maxRing) maxRing = grid->size[2];
+
+	#pragma omp parallel
+	{
+		// bones span several cells, so remember which ones this vertex has already measured
+		int* visited = (int *) malloc(boneCount * sizeof(int));
+		for(int b = 0; b < boneCount; b++) {
+			visited[b] = -1;
+		}
+
+		#pragma omp for schedule(dynamic, 4096)
+		for(int v = 0; v < vertexCount; v++) {
+			const float* p = positions + v * 3;
+			float bestDistance[MAX_INFLUENCES];
+			int bestBone[MAX_INFLUENCES];
+			for(int k = 0; k < influences; k++) {
+				bestDistance[k] = 1e30f;
+				bestBone[k] = -1;
+			}
+
+			int home[3];
+			cellOf(grid, p, home);
+			for(int ring = 0; ring <= maxRing; ring++) {
+				for(int dz = -ring; dz <= ring; dz++) {
+					int z = home[2] + dz;
+					if(z < 0 || z >= grid->size[2]) continue;
+					for(int dy = -ring; dy <= ring; dy++) {
+						int y = home[1] + dy;
+						if(y < 0 || y >= grid->size[1]) continue;
+						// only the shell of the cube is new in this ring
+						bool shell = (dz == -ring || dz == ring || dy == -ring || dy == ring);
+						int step = shell ? 1 : 2 * ring;
+						for(int dx = -ring; dx <= ring; dx += step) {
+							int x = home[0] + dx;
+							if(x < 0 || x >= grid->size[0]) continue;
+							if(cellDistanceSquared(grid, p, x, y, z) >= bestDistance[influences - 1]) continue;
+							int c = (z * grid->size[1] + y) * grid->size[0] + x;
+							for(int i = grid->cellStart[c]; i < grid->cellStart[c + 1]; i++) {
+								int b = grid->cellBones[i];
+								if(visited[b] == v) continue;
+								visited[b] = v;
+								float d = segmentDistanceSquared(p, segments + b);
+								insertCandidate(bestDistance, bestBone, influences, d, b);
+							}
+						}
+					}
+				}
+				// every bone not seen yet lies outside the cube of cells searched so far,
+				// so the distance to its nearest open face bounds them all
+				float reach = 1e30f;
+				for(int a = 0; a < 3; a++) {
+					if(home[a] - ring > 0) {
+						float face = p[a] - (grid->origin[a] + (home[a] - ring) * grid->cellSize);
+						if(face < reach) reach = face;
+					}
+					if(home[a] + ring < grid->size[a] - 1) {
+						float face = grid->origin[a] + (home[a] + ring + 1) * grid->cellSize - p[a];
+						if(face < reach) reach = face;
+					}
+				}
+				if(bestBone[influences - 1] >= 0 && bestDistance[influences - 1] <= reach * reach) {
+					break;
+				}
+			}
+
+			double w[MAX_INFLUENCES];
+			double sum = 0.0;
+			for(int k = 0; k < influences; k++) {
+				w[k] = 0.0;
+				if(bestBone[k] >= 0) {
+					w[k] = 1.0 / pow(sqrt((double) bestDistance[k]) + 1e-6, falloff);
+					sum += w[k];
+				}
+			}
+			for(int k = 0; k < influences; k++) {
+				skinWeights->bones[v * influences + k] = bestBone[k];
+				skinWeights->weights[v * influences + k] = sum > 0.0 ? w[k] / sum : 0.0f;
+			}
+		}
+		free(visited);
+	}
+
+	free(segments);
+	freeBoneGrid(grid);
+	return skinWeights;
+}
+
+void freeSkinWeights(SkinWeights* skinWeights)
+{
+	free(skinWeights->bones);
+	free(skinWeights->weights);
+	delete skinWeights;
+}
+
+static unsigned int hashBytes(unsigned int hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char *) data;
+	for(size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 16777619u; // FNV-1a
+	}
+	return hash;
+}
+
+unsigned int skinWeightsKey(const float* positions, int vertexCount,
+							const float* boneStarts, const float* boneEnds, int boneCount,
+							int influences, float falloff)
+{
+	unsigned int hash = 2166136261u;
+	hash = hashBytes(hash, positions, vertexCount * 3 * sizeof(float));
+	hash = hashBytes(hash, boneStarts, boneCount * 3 * sizeof(float));
+	hash = hashBytes(hash, boneEnds, boneCount * 3 * sizeof(float));
+	hash = hashBytes(hash, &influences, sizeof(influences));
+	hash = hashBytes(hash, &falloff, sizeof(falloff));
+	return hash;
+}
+
+bool saveSkinWeights(const char* path, const SkinWeights* skinWeights, unsigned int key)
+{
+	FILE* file = fopen(path, "wb");
+	if(file == NULL) {
+		return false;
+	}
+	int count = skinWeights->vertexCount * skinWeights->influences;
+	unsigned int header[5] = {SKIN_WEIGHTS_MAGIC, SKIN_WEIGHTS_VERSION, key,
+							  (unsigned int) skinWeights->vertexCount, (unsigned int) skinWeights->influences};
+	bool ok = fwrite(header, sizeof(header), 1, file) == 1
+		&& fwrite(skinWeights->bones, sizeof(int), count, file) == (size_t) count
+		&& fwrite(skinWeights->weights, sizeof(float), count, file) == (size_t) count;
+	fclose(file);
+	if(!ok) {
+		remove(path);
+	}
+	return ok;
+}
+
+SkinWeights* loadSkinWeights(const char* path, unsigned int key, int vertexCount, int influences)
+{
+	FILE* file = fopen(path, "rb");
+	if(file == NULL) {
+		return NULL;
+	}
+	unsigned int header[5];
+	if(fread(header, sizeof(header), 1, file) != 1
+		|| header[0] != SKIN_WEIGHTS_MAGIC || header[1] != SKIN_WEIGHTS_VERSION || header[2] != key
+		|| header[3] != (unsigned int) vertexCount || header[4] != (unsigned int) influences) {
+		fclose(file);
+		return NULL;
+	}
+
+	int count = vertexCount * influences;
+	SkinWeights* skinWeights = new SkinWeights();
+	skinWeights->vertexCount = vertexCount;
+	skinWeights->influences = influences;
+	skinWeights->bones = (int *) malloc(count * sizeof(int));
+	skinWeights->weights = (float *) malloc(count * sizeof(float));
+	bool ok = fread(skinWeights->bones, sizeof(int), count, file) == (size_t) count
+		&& fread(skinWeights->weights, sizeof(float), count, file) == (size_t) count;
+	fclose(file);
+	if(!ok) {
+		freeSkinWeights(skinWeights);
+		return NULL;
+	}
+	return skinWeights;
+}
+
+SkinWeights* loadOrComputeSkinWeights(const char* path, const float* positions, int vertexCount,
+									  const float* boneStarts, const float* boneEnds, int boneCount,
+									  int influences, float falloff)
+{
+	if(influences > MAX_INFLUENCES) influences = MAX_INFLUENCES;
+	if(influences > boneCount) influences = boneCount;
+	if(influences <= 0 || vertexCount < 0) {
+		return NULL;
+	}
+
+	unsigned int key = skinWeightsKey(positions, vertexCount, boneStarts, boneEnds, boneCount, influences, falloff);
+	SkinWeights* skinWeights = loadSkinWeights(path, key, vertexCount, influences);
+	if(skinWeights != NULL) {
+		return skinWeights;
+	}
+	skinWeights = computeSkinWeights(positions, vertexCount, boneStarts, boneEnds, boneCount, influences, falloff);
+	if(!saveSkinWeights(path, skinWeights, key)) {
+		printf("could not write skin weight cache %s\n", path);
+	}
+	return skinWeights;
+}
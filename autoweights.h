@@ -0,0 +1,41 @@
+// Vertex Skinning
+// Automatic skin weights from bone segments, with an on-disk cache.
+
+#ifndef AUTOWEIGHTS_H
+#define AUTOWEIGHTS_H
+
+#define MAX_INFLUENCES 4
+
+class SkinWeights {
+public:
+	int vertexCount;
+	int influences;  // K, at most MAX_INFLUENCES
+	int* bones;      // vertexCount * influences bone indices, nearest first, -1 if unused
+	float* weights;  // vertexCount * influences, every vertex sums to 1
+};
+
+// Every vertex (3 floats each) gets its K nearest bones, where a bone is the segment
+// boneStarts[i]..boneEnds[i]. Weights fall off as 1 / distance^falloff and are normalized.
+// A uniform grid over the bones keeps the search local; vertices are split across threads.
+// NULL if there are no bones or influences to assign.
+SkinWeights* computeSkinWeights(const float* positions, int vertexCount,
+								const float* boneStarts, const float* boneEnds, int boneCount,
+								int influences, float falloff);
+void freeSkinWeights(SkinWeights* skinWeights);
+
+// Hash of everything computeSkinWeights depends on, stored in the cache file
+unsigned int skinWeightsKey(const float* positions, int vertexCount,
+							const float* boneStarts, const float* boneEnds, int boneCount,
+							int influences, float falloff);
+
+bool saveSkinWeights(const char* path, const SkinWeights* skinWeights, unsigned int key);
+// NULL if the file is missing, unreadable or was written for different inputs
+SkinWeights* loadSkinWeights(const char* path, unsigned int key, int vertexCount, int influences);
+
+// Loads the cached weights when they match the inputs, otherwise computes and caches them.
+// NULL in the same cases as computeSkinWeights.
+SkinWeights* loadOrComputeSkinWeights(const char* path, const float* positions, int vertexCount,
+									  const float* boneStarts, const float* boneEnds, int boneCount,
+									  int influences, float falloff);
+
+#endif
@@ -0,0 +1,397 @@
+// Vertex Skinning
+// Headless benchmarks for the pieces that run at load time or every frame.
+// Build and run with: make bench, or ./vertexskinning_bench [weights] [pose] [blend] [lines]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "autoweights.h"
+#include "pose.h"
+#include "blend.h"
+#include "debugdraw.h"
+#include "skinning.h"
+#include "timer.h"
+
+#define BENCH_WEIGHTS_CACHE "bench.weights"
+
+static float randomFloat(float lo, float hi)
+{
+	return lo + (hi - lo) * (rand() / (float) RAND_MAX);
+}
+
+// A random tree of bones with vertices scattered in a tube around each of them
+static void createSyntheticRig(int boneCount, int vertexCount, float** boneStarts, float** boneEnds, float** positions)
+{
+	*boneStarts = (float *) malloc(boneCount * 3 * sizeof(float));
+	*boneEnds = (float *) malloc(boneCount * 3 * sizeof(float));
+	*positions = (float *) malloc(vertexCount * 3 * sizeof(float));
+
+	for(int b = 0; b < boneCount; b++) {
+		float* start = *boneStarts + b * 3;
+		float* end = *boneEnds + b * 3;
+		if(b == 0) {
+			start[0] = start[1] = start[2] = 0.0f;
+		} else {
+			const float* parentEnd = *boneEnds + (rand() % b) * 3;
+			start[0] = parentEnd[0];
+			start[1] = parentEnd[1];
+			start[2] = parentEnd[2];
+		}
+		float d[3] = {randomFloat(-1, 1), randomFloat(-1, 1), randomFloat(-1, 1)};
+		float length = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) + 1e-6f;
+		for(int a = 0; a < 3; a++) {
+			end[a] = start[a] + d[a] / length * 5.0f;
+		}
+	}
+
+	for(int v = 0; v < vertexCount; v++) {
+		int b = rand() % boneCount;
+		float t = randomFloat(0, 1);
+		for(int a = 0; a < 3; a++) {
+			float start = (*boneStarts)[b * 3 + a];
+			float end = (*boneEnds)[b * 3 + a];
+			(*positions)[v * 3 + a] = start + t * (end - start) + randomFloat(-1.5f, 1.5f);
+		}
+	}
+}
+
+static float segmentDistanceSquared(const float* p, const float* a, const float* b)
+{
+	float ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+	float ap[3] = {p[0] - a[0], p[1] - a[1], p[2] - a[2]};
+	float t = (ap[0] * ab[0] + ap[1] * ab[1] + ap[2] * ab[2]) / (ab[0] * ab[0] + ab[1] * ab[1] + ab[2] * ab[2]);
+	t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+	float d[3] = {ap[0] - t * ab[0], ap[1] - t * ab[1], ap[2] - t * ab[2]};
+	return d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+}
+
+static void benchAutoWeights(int vertexCount, int boneCount, int influences)
+{
+	float *boneStarts, *boneEnds, *positions;
+	createSyntheticRig(boneCount, vertexCount, &boneStarts, &boneEnds, &positions);
+	printf("auto weights: %d vertices, %d bones, %d influences\n", vertexCount, boneCount, influences);
+
+	double start = nowSeconds();
+	SkinWeights* weights = computeSkinWeights(positions, vertexCount, boneStarts, boneEnds, boneCount, influences, 4.0f);
+	double computeTime = nowSeconds() - start;
+	printf("  compute:    %8.3f s (%.1f ns/vertex)\n", computeTime, computeTime / vertexCount * 1e9);
+
+	// the grid search has to agree with trying every bone: the same K bones, in order, with the same weights
+	int checked = vertexCount < 20000 ? vertexCount : 20000;
+	int k = weights->influences;
+	int mismatches = 0;
+	float maxWeightError = 0.0f;
+	start = nowSeconds();
+	for(int v = 0; v < checked; v++) {
+		const float* p = positions + v * 3;
+		float nearest[MAX_INFLUENCES];
+		for(int i = 0; i < k; i++) {
+			nearest[i] = 1e30f;
+		}
+		for(int b = 0; b < boneCount; b++) {
+			float distance = segmentDistanceSquared(p, boneStarts + b * 3, boneEnds + b * 3);
+			for(int i = 0; i < k; i++) {
+				if(distance < nearest[i]) {
+					for(int j = k - 1; j > i; j--) {
+						nearest[j] = nearest[j - 1];
+					}
+					nearest[i] = distance;
+					break;
+				}
+			}
+		}
+		double w[MAX_INFLUENCES];
+		double sum = 0.0;
+		for(int i = 0; i < k; i++) {
+			w[i] = 1.0 / pow(sqrt((double) nearest[i]) + 1e-6, 4.0);
+			sum += w[i];
+		}
+		bool differs = false;
+		for(int i = 0; i < k; i++) {
+			int b = weights->bones[v * k + i];
+			float distance = b >= 0 ? segmentDistanceSquared(p, boneStarts + b * 3, boneEnds + b * 3) : 1e30f;
+			// ties may swap bones, so the distances are compared rather than the indices
+			if(fabs(distance - nearest[i]) > 1e-4f * (1.0f + nearest[i])) {
+				differs = true;
+			}
+			float weightError = fabs(weights->weights[v * k + i] - w[i] / sum);
+			if(weightError > maxWeightError) {
+				maxWeightError = weightError;
+			}
+		}
+		if(differs) {
+			mismatches++;
+		}
+	}
+	double bruteTime = (nowSeconds() - start) / checked;
+	printf("  brute force K nearest: %.1f ns/vertex (%.1fx the grid)\n",
+		   bruteTime * 1e9, bruteTime / (computeTime / vertexCount));
+	printf("  K nearest bones differ from brute force on %d of %d vertices, max weight difference %g\n",
+		   mismatches, checked, maxWeightError);
+
+	unsigned int key = skinWeightsKey(positions, vertexCount, boneStarts, boneEnds, boneCount, influences, 4.0f);
+	start = nowSeconds();
+	saveSkinWeights(BENCH_WEIGHTS_CACHE, weights, key);
+	double saveTime = nowSeconds() - start;
+	start = nowSeconds();
+	SkinWeights* cached = loadSkinWeights(BENCH_WEIGHTS_CACHE, key, vertexCount, influences);
+	double loadTime = nowSeconds() - start;
+	printf("  cache save: %8.3f s, cache load: %.3f s%s\n", saveTime, loadTime, cached != NULL ? "" : " (FAILED)");
+
+	if(cached != NULL) {
+		freeSkinWeights(cached);
+	}
+	remove(BENCH_WEIGHTS_CACHE);
+	freeSkinWeights(weights);
+	free(boneStarts);
+	free(boneEnds);
+	free(positions);
+}
+
+// Local pose to matrices for a crowd, old per-bone path against the batch conversion,
+// and how that compares with skinning one rig's mesh
+static void benchPoseConversion(int instances, int bonesPerRig, int verticesPerRig)
+{
+	int count = instances * bonesPerRig;
+	float* x = (float *) malloc(count * sizeof(float));
+	float* y = (float *) malloc(count * sizeof(float));
+	float* z = (float *) malloc(count * sizeof(float));
+	float* reference = (float *) malloc(count * 16 * sizeof(float));
+	float* matrices = (float *) malloc(count * 16 * sizeof(float));
+	PoseBuffer* pose = createPoseBuffer(count);
+	for(int i = 0; i < count; i++) {
+		x[i] = randomFloat(-180, 180);
+		y[i] = randomFloat(-180, 180);
+		z[i] = randomFloat(-180, 180);
+		pose->tx[i] = randomFloat(-5, 5);
+		pose->sx[i] = randomFloat(0.5f, 2.0f);
+	}
+	printf("pose conversion: %d instances x %d bones\n", instances, bonesPerRig);
+
+	double start = nowSeconds();
+	for(int i = 0; i < count; i++) {
+		eulerToMatrixReference(x[i], y[i], z[i], pose->sx[i], pose->sy[i], pose->sz[i], reference + i * 16);
+	}
+	double referenceTime = (nowSeconds() - start) / count;
+
+	const int repeats = 10;
+	start = nowSeconds();
+	for(int r = 0; r < repeats; r++) {
+		eulerToQuaternions(x, y, z, pose->qx, pose->qy, pose->qz, pose->qw, count);
+		poseToMatrices(pose, matrices);
+	}
+	double eulerTime = (nowSeconds() - start) / (count * repeats);
+
+	start = nowSeconds();
+	for(int r = 0; r < repeats; r++) {
+		poseToMatrices(pose, matrices);
+	}
+	double quaternionTime = (nowSeconds() - start) / (count * repeats);
+
+	// the reference leaves the translation out
+	float maxError = 0.0f;
+	for(int i = 0; i < count; i++) {
+		for(int k = 0; k < 12; k++) {
+			float error = fabs(reference[i * 16 + k] - matrices[i * 16 + k]);
+			if(error > maxError) {
+				maxError = error;
+			}
+		}
+	}
+
+	Vertex* original = new Vertex[verticesPerRig];
+	Vertex* weighted = new Vertex[verticesPerRig];
+	for(int v = 0; v < verticesPerRig; v++) {
+		float w = randomFloat(0, 1);
+		original[v] = Vertex(randomFloat(-2, 2), randomFloat(0, 10), randomFloat(-2, 2), 0, 1, w, 1.0f - w);
+	}
+	float base[3] = {0.0f, 5.0f, 0.0f};
+	start = nowSeconds();
+	for(int r = 0; r < repeats; r++) {
+		skinVertices(original, weighted, verticesPerRig, matrices, matrices + 16, base, NULL, 0, NULL, NULL);
+	}
+	double skinTime = (nowSeconds() - start) / repeats;
+
+	printf("  per bone: %.1f ns old path, %.1f ns batch from euler, %.1f ns batch from quaternions\n",
+		   referenceTime * 1e9, eulerTime * 1e9, quaternionTime * 1e9);
+	printf("  max matrix difference against the old path: %g\n", maxError);
+	printf("  one rig: %.2f us batch pose vs %.2f us skinning %d vertices (%.1f%%), old path was %.2f us\n",
+		   eulerTime * bonesPerRig * 1e6, skinTime * 1e6, verticesPerRig,
+		   100.0 * eulerTime * bonesPerRig / skinTime, referenceTime * bonesPerRig * 1e6);
+
+	delete[] original;
+	delete[] weighted;
+	freePoseBuffer(pose);
+	free(x);
+	free(y);
+	free(z);
+	free(reference);
+	free(matrices);
+}
+
+static void randomPose(PoseBuffer* pose)
+{
+	for(int i = 0; i < pose->count; i++) {
+		float x = randomFloat(-1, 1), y = randomFloat(-1, 1), z = randomFloat(-1, 1), w = randomFloat(-1, 1);
+		float inverseLength = 1.0f / sqrt(x * x + y * y + z * z + w * w);
+		pose->qx[i] = x * inverseLength;
+		pose->qy[i] = y * inverseLength;
+		pose->qz[i] = z * inverseLength;
+		pose->qw[i] = w * inverseLength;
+		pose->tx[i] = randomFloat(-1, 1);
+		pose->ty[i] = randomFloat(-1, 1);
+		pose->tz[i] = randomFloat(-1, 1);
+		pose->sx[i] = pose->sy[i] = pose->sz[i] = randomFloat(0.8f, 1.2f);
+	}
+}
+
+// angle in radians between the rotations of two unit quaternions
+static double rotationAngle(double ax, double ay, double az, double aw, double bx, double by, double bz, double bw)
+{
+	double dot = fabs(ax * bx + ay * by + az * bz + aw * bw);
+	return 2.0 * acos(dot > 1.0 ? 1.0 : dot);
+}
+
+// A crowd sharing one blend tree: idle and walk blended, a masked upper body
+// layer on top and an additive offset, all over instances * bonesPerRig bones
+static void benchBlending(int instances, int bonesPerRig)
+{
+	int count = instances * bonesPerRig;
+	PoseBuffer* idle = createPoseBuffer(count);
+	PoseBuffer* walk = createPoseBuffer(count);
+	PoseBuffer* wave = createPoseBuffer(count);
+	PoseBuffer* offsets = createPoseBuffer(count);
+	randomPose(idle);
+	randomPose(walk);
+	randomPose(wave);
+	randomPose(offsets);
+	float* upperBody = (float *) malloc(count * sizeof(float));
+	for(int i = 0; i < count; i++) {
+		upperBody[i] = (i % bonesPerRig) < bonesPerRig / 2 ? 1.0f : 0.0f;
+	}
+
+	BlendTree* tree = createBlendTree(count);
+	int a = addSourceNode(tree, "idle", idle);
+	int b = addSourceNode(tree, "walk", walk);
+	int c = addSourceNode(tree, "wave", wave);
+	int d = addSourceNode(tree, "offsets", offsets);
+	int locomotion = addLerpNode(tree, "locomotion", a, b, 0.35f, NULL);
+	int nlerp = addLerpNode(tree, "nlerp", a, b, 0.35f, NULL);
+	tree->nodes[nlerp].slerp = false;
+	int upper = addLerpNode(tree, "upperbody", locomotion, c, 0.8f, upperBody);
+	addAdditiveNode(tree, "offsets", upper, d, 0.5f, NULL);
+
+	printf("pose blending: %d instances x %d bones\n", instances, bonesPerRig);
+	for(int r = 0; r < 50; r++) {
+		evaluateBlendTree(tree);
+	}
+	printBlendStats(tree);
+
+	// the corrected nlerp against a real slerp
+	double slerpError = 0.0, nlerpError = 0.0;
+	const PoseBuffer* corrected = tree->nodes[locomotion].result;
+	const PoseBuffer* plain = tree->nodes[nlerp].result;
+	for(int i = 0; i < count; i++) {
+		double dot = idle->qx[i] * walk->qx[i] + idle->qy[i] * walk->qy[i] + idle->qz[i] * walk->qz[i] + idle->qw[i] * walk->qw[i];
+		double sign = dot < 0.0 ? -1.0 : 1.0;
+		double theta = acos(fabs(dot) > 1.0 ? 1.0 : fabs(dot));
+		double wa = 1.0 - 0.35, wb = 0.35;
+		if(theta > 1e-6) {
+			wa = sin((1.0 - 0.35) * theta) / sin(theta);
+			wb = sin(0.35 * theta) / sin(theta);
+		}
+		double x = wa * idle->qx[i] + wb * sign * walk->qx[i];
+		double y = wa * idle->qy[i] + wb * sign * walk->qy[i];
+		double z = wa * idle->qz[i] + wb * sign * walk->qz[i];
+		double w = wa * idle->qw[i] + wb * sign * walk->qw[i];
+		double e = rotationAngle(x, y, z, w, corrected->qx[i], corrected->qy[i], corrected->qz[i], corrected->qw[i]);
+		if(e > slerpError) slerpError = e;
+		e = rotationAngle(x, y, z, w, plain->qx[i], plain->qy[i], plain->qz[i], plain->qw[i]);
+		if(e > nlerpError) nlerpError = e;
+	}
+	printf("  max angle from exact slerp: %.2e rad corrected, %.2e rad plain nlerp\n", slerpError, nlerpError);
+
+	freeBlendTree(tree);
+	freePoseBuffer(idle);
+	freePoseBuffer(walk);
+	freePoseBuffer(wave);
+	freePoseBuffer(offsets);
+	free(upperBody);
+}
+
+// Skeleton gizmos for a crowd written into one line buffer
+static void benchSkeletonLines(int instances, int bonesPerRig)
+{
+	int count = instances * bonesPerRig;
+	PoseBuffer* pose = createPoseBuffer(count);
+	randomPose(pose);
+	int* parents = (int *) malloc(count * sizeof(int));
+	float* lengths = (float *) malloc(count * sizeof(float));
+	for(int i = 0; i < count; i++) {
+		parents[i] = i % bonesPerRig == 0 ? -1 : i - 1 - rand() % (i % bonesPerRig);
+		lengths[i] = -randomFloat(1, 5);
+	}
+	float* local = (float *) malloc(count * 16 * sizeof(float));
+	float* world = (float *) malloc(count * 16 * sizeof(float));
+	DebugLines* lines = createDebugLines(count * DEBUG_LINES_PER_BONE);
+
+	const int repeats = 10;
+	double worldTime = 0.0, lineTime = 0.0;
+	for(int r = 0; r < repeats; r++) {
+		double start = nowSeconds();
+		poseToMatrices(pose, local);
+		localToWorldMatrices(pose, parents, world);
+		worldTime += nowSeconds() - start;
+
+		start = nowSeconds();
+		clearDebugLines(lines);
+		for(int n = 0; n < instances; n++) {
+			appendSkeletonLines(lines, world + n * bonesPerRig * 16, lengths + n * bonesPerRig, bonesPerRig);
+		}
+		lineTime += nowSeconds() - start;
+	}
+	printf("skeleton lines: %d instances x %d bones, %d line vertices in one buffer\n", instances, bonesPerRig, lines->count);
+	printf("  world matrices %.2f ms, line buffer %.2f ms per frame (%.1f ns/bone)\n",
+		   worldTime / repeats * 1e3, lineTime / repeats * 1e3, lineTime / repeats / count * 1e9);
+
+	freeDebugLines(lines);
+	freePoseBuffer(pose);
+	free(parents);
+	free(lengths);
+	free(local);
+	free(world);
+}
+
+static bool selected(int argc, char** argv, const char* name)
+{
+	if(argc < 2) {
+		return true;
+	}
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Runs every benchmark, or only the ones named on the command line
+int main(int argc, char** argv)
+{
+	srand(1);
+	if(selected(argc, argv, "weights")) {
+		benchAutoWeights(1000000, 100, 4);
+		benchAutoWeights(1000000, 1000, 4);
+	}
+	if(selected(argc, argv, "pose")) {
+		benchPoseConversion(1000, 200, 10000);
+	}
+	if(selected(argc, argv, "blend")) {
+		benchBlending(1000, 200);
+	}
+	if(selected(argc, argv, "lines")) {
+		benchSkeletonLines(1000, 200);
+	}
+	return 0;
+}
@@ -0,0 +1,299 @@
+// Vertex Skinning
+// Blending and layering of whole pose buffers.
+
+#include "blend.h"
+#include "timer.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Corrects the nlerp parameter so the result follows slerp's constant angular speed.
+// d is the absolute cosine between the two quaternions (zeux.io, "Approximating slerp").
+static inline float slerpCorrection(float t, float d)
+{
+	float A = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+	float B = 0.848013f + d * (-1.06021f + d * 0.215638f);
+	float k = A * (t - 0.5f) * (t - 0.5f) + B;
+	return t + t * (t - 0.5f) * (t - 1.0f) * k;
+}
+
+static void blendBone(PoseBuffer* result, const PoseBuffer* a, const PoseBuffer* b, int i, float t, bool slerp)
+{
+	float dot = a->qx[i] * b->qx[i] + a->qy[i] * b->qy[i] + a->qz[i] * b->qz[i] + a->qw[i] * b->qw[i];
+	float sign = dot < 0.0f ? -1.0f : 1.0f;
+	float rt = slerp ? slerpCorrection(t, fabs(dot)) : t;
+
+	float x = a->qx[i] + (sign * b->qx[i] - a->qx[i]) * rt;
+	float y = a->qy[i] + (sign * b->qy[i] - a->qy[i]) * rt;
+	float z = a->qz[i] + (sign * b->qz[i] - a->qz[i]) * rt;
+	float w = a->qw[i] + (sign * b->qw[i] - a->qw[i]) * rt;
+	float inverseLength = 1.0f / sqrtf(x * x + y * y + z * z + w * w);
+	result->qx[i] = x * inverseLength;
+	result->qy[i] = y * inverseLength;
+	result->qz[i] = z * inverseLength;
+	result->qw[i] = w * inverseLength;
+
+	result->tx[i] = a->tx[i] + (b->tx[i] - a->tx[i]) * t;
+	result->ty[i] = a->ty[i] + (b->ty[i] - a->ty[i]) * t;
+	result->tz[i] = a->tz[i] + (b->tz[i] - a->tz[i]) * t;
+	result->sx[i] = a->sx[i] + (b->sx[i] - a->sx[i]) * t;
+	result->sy[i] = a->sy[i] + (b->sy[i] - a->sy[i]) * t;
+	result->sz[i] = a->sz[i] + (b->sz[i] - a->sz[i]) * t;
+}
+
+void blendPoses(PoseBuffer* result, const PoseBuffer* a, const PoseBuffer* b,
+				float weight, const float* mask, bool slerp)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 weights = _mm_set1_ps(weight);
+	for(; i + 4 <= result->count; i += 4) {
+		__m128 t = mask != NULL ? _mm_mul_ps(weights, _mm_loadu_ps(mask + i)) : weights;
+
+		__m128 ax = _mm_loadu_ps(a->qx + i), ay = _mm_loadu_ps(a->qy + i);
+		__m128 az = _mm_loadu_ps(a->qz + i), aw = _mm_loadu_ps(a->qw + i);
+		__m128 bx = _mm_loadu_ps(b->qx + i), by = _mm_loadu_ps(b->qy + i);
+		__m128 bz = _mm_loadu_ps(b->qz + i), bw = _mm_loadu_ps(b->qw + i);
+
+		// flip b onto a's hemisphere
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+								_mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+		__m128 sign = _mm_and_ps(dot, signMask);
+		bx = _mm_xor_ps(bx, sign);
+		by = _mm_xor_ps(by, sign);
+		bz = _mm_xor_ps(bz, sign);
+		bw = _mm_xor_ps(bw, sign);
+
+		__m128 rt = t;
+		if(slerp) {
+			__m128 d = _mm_andnot_ps(signMask, dot);
+			__m128 A = _mm_sub_ps(_mm_set1_ps(3.55645f), _mm_mul_ps(d, _mm_set1_ps(1.43519f)));
+			A = _mm_add_ps(_mm_set1_ps(-3.2452f), _mm_mul_ps(d, A));
+			A = _mm_add_ps(_mm_set1_ps(1.0904f), _mm_mul_ps(d, A));
+			__m128 B = _mm_add_ps(_mm_set1_ps(-1.06021f), _mm_mul_ps(d, _mm_set1_ps(0.215638f)));
+			B = _mm_add_ps(_mm_set1_ps(0.848013f), _mm_mul_ps(d, B));
+			__m128 centered = _mm_sub_ps(t, half);
+			__m128 k = _mm_add_ps(_mm_mul_ps(A, _mm_mul_ps(centered, centered)), B);
+			rt = _mm_add_ps(t, _mm_mul_ps(_mm_mul_ps(t, centered), _mm_mul_ps(_mm_sub_ps(t, one), k)));
+		}
+
+		__m128 x = _mm_add_ps(ax, _mm_mul_ps(_mm_sub_ps(bx, ax), rt));
+		__m128 y = _mm_add_ps(ay, _mm_mul_ps(_mm_sub_ps(by, ay), rt));
+		__m128 z = _mm_add_ps(az, _mm_mul_ps(_mm_sub_ps(bz, az), rt));
+		__m128 w = _mm_add_ps(aw, _mm_mul_ps(_mm_sub_ps(bw, aw), rt));
+		__m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+										  _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+		__m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+		_mm_storeu_ps(result->qx + i, _mm_mul_ps(x, inverseLength));
+		_mm_storeu_ps(result->qy + i, _mm_mul_ps(y, inverseLength));
+		_mm_storeu_ps(result->qz + i, _mm_mul_ps(z, inverseLength));
+		_mm_storeu_ps(result->qw + i, _mm_mul_ps(w, inverseLength));
+
+		// translation and scale are six more plain lerps
+		const float* from[6] = {a->tx, a->ty, a->tz, a->sx, a->sy, a->sz};
+		const float* to[6] = {b->tx, b->ty, b->tz, b->sx, b->sy, b->sz};
+		float* out[6] = {result->tx, result->ty, result->tz, result->sx, result->sy, result->sz};
+		for(int c = 0; c < 6; c++) {
+			__m128 f = _mm_loadu_ps(from[c] + i);
+			_mm_storeu_ps(out[c] + i, _mm_add_ps(f, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(to[c] + i), f), t)));
+		}
+	}
+#endif
+	for(; i < result->count; i++) {
+		blendBone(result, a, b, i, mask != NULL ? weight * mask[i] : weight, slerp);
+	}
+}
+
+static void addBone(PoseBuffer* result, const PoseBuffer* base, const PoseBuffer* additive, int i, float t)
+{
+	// scale the additive rotation down towards identity, then apply it after the base one
+	float sign = additive->qw[i] < 0.0f ? -1.0f : 1.0f;
+	float ax = sign * additive->qx[i] * t;
+	float ay = sign * additive->qy[i] * t;
+	float az = sign * additive->qz[i] * t;
+	float aw = 1.0f + (sign * additive->qw[i] - 1.0f) * t;
+	float inverseLength = 1.0f / sqrtf(ax * ax + ay * ay + az * az + aw * aw);
+	ax *= inverseLength;
+	ay *= inverseLength;
+	az *= inverseLength;
+	aw *= inverseLength;
+
+	float bx = base->qx[i], by = base->qy[i], bz = base->qz[i], bw = base->qw[i];
+	result->qx[i] = bw * ax + bx * aw + by * az - bz * ay;
+	result->qy[i] = bw * ay - bx * az + by * aw + bz * ax;
+	result->qz[i] = bw * az + bx * ay - by * ax + bz * aw;
+	result->qw[i] = bw * aw - bx * ax - by * ay - bz * az;
+
+	result->tx[i] = base->tx[i] + additive->tx[i] * t;
+	result->ty[i] = base->ty[i] + additive->ty[i] * t;
+	result->tz[i] = base->tz[i] + additive->tz[i] * t;
+	result->sx[i] = base->sx[i] * (1.0f + (additive->sx[i] - 1.0f) * t);
+	result->sy[i] = base->sy[i] * (1.0f + (additive->sy[i] - 1.0f) * t);
+	result->sz[i] = base->sz[i] * (1.0f + (additive->sz[i] - 1.0f) * t);
+}
+
+void addPoses(PoseBuffer* result, const PoseBuffer* base, const PoseBuffer* additive,
+			  float weight, const float* mask)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 weights = _mm_set1_ps(weight);
+	for(; i + 4 <= result->count; i += 4) {
+		__m128 t = mask != NULL ? _mm_mul_ps(weights, _mm_loadu_ps(mask + i)) : weights;
+
+		__m128 aw = _mm_loadu_ps(additive->qw + i);
+		__m128 sign = _mm_and_ps(aw, signMask);
+		__m128 ax = _mm_mul_ps(_mm_xor_ps(_mm_loadu_ps(additive->qx + i), sign), t);
+		__m128 ay = _mm_mul_ps(_mm_xor_ps(_mm_loadu_ps(additive->qy + i), sign), t);
+		__m128 az = _mm_mul_ps(_mm_xor_ps(_mm_loadu_ps(additive->qz + i), sign), t);
+		aw = _mm_add_ps(one, _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(aw, sign), one), t));
+		__m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, ax), _mm_mul_ps(ay, ay)),
+										  _mm_add_ps(_mm_mul_ps(az, az), _mm_mul_ps(aw, aw)));
+		__m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+		ax = _mm_mul_ps(ax, inverseLength);
+		ay = _mm_mul_ps(ay, inverseLength);
+		az = _mm_mul_ps(az, inverseLength);
+		aw = _mm_mul_ps(aw, inverseLength);
+
+		__m128 bx = _mm_loadu_ps(base->qx + i), by = _mm_loadu_ps(base->qy + i);
+		__m128 bz = _mm_loadu_ps(base->qz + i), bw = _mm_loadu_ps(base->qw + i);
+		_mm_storeu_ps(result->qx + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(bw, ax), _mm_mul_ps(bx, aw)),
+												 _mm_sub_ps(_mm_mul_ps(by, az), _mm_mul_ps(bz, ay))));
+		_mm_storeu_ps(result->qy + i, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(bw, ay), _mm_mul_ps(bx, az)),
+												 _mm_add_ps(_mm_mul_ps(by, aw), _mm_mul_ps(bz, ax))));
+		_mm_storeu_ps(result->qz + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(bw, az), _mm_mul_ps(bx, ay)),
+												 _mm_sub_ps(_mm_mul_ps(bz, aw), _mm_mul_ps(by, ax))));
+		_mm_storeu_ps(result->qw + i, _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(bw, aw), _mm_mul_ps(bx, ax)),
+												 _mm_add_ps(_mm_mul_ps(by, ay), _mm_mul_ps(bz, az))));
+
+		const float* translations[3] = {additive->tx, additive->ty, additive->tz};
+		const float* baseTranslations[3] = {base->tx, base->ty, base->tz};
+		float* outTranslations[3] = {result->tx, result->ty, result->tz};
+		const float* scales[3] = {additive->sx, additive->sy, additive->sz};
+		const float* baseScales[3] = {base->sx, base->sy, base->sz};
+		float* outScales[3] = {result->sx, result->sy, result->sz};
+		for(int c = 0; c < 3; c++) {
+			_mm_storeu_ps(outTranslations[c] + i, _mm_add_ps(_mm_loadu_ps(baseTranslations[c] + i),
+															 _mm_mul_ps(_mm_loadu_ps(translations[c] + i), t)));
+			__m128 scale = _mm_add_ps(one, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(scales[c] + i), one), t));
+			_mm_storeu_ps(outScales[c] + i, _mm_mul_ps(_mm_loadu_ps(baseScales[c] + i), scale));
+		}
+	}
+#endif
+	for(; i < result->count; i++) {
+		addBone(result, base, additive, i, mask != NULL ? weight * mask[i] : weight);
+	}
+}
+
+BlendTree* createBlendTree(int count)
+{
+	BlendTree* tree = new BlendTree();
+	tree->count = count;
+	tree->nodeCount = 0;
+	return tree;
+}
+
+void freeBlendTree(BlendTree* tree)
+{
+	for(int n = 0; n < tree->nodeCount; n++) {
+		if(tree->nodes[n].type != BLEND_SOURCE) {
+			freePoseBuffer(tree->nodes[n].result);
+		}
+	}
+	delete tree;
+}
+
+static int addNode(BlendTree* tree, int type, const char* name, int inputA, int inputB, float weight, const float* mask)
+{
+	if(tree->nodeCount >= MAX_BLEND_NODES) {
+		printf("blend tree is full, dropping node %s\n", name);
+		return -1;
+	}
+	BlendNode* node = &tree->nodes[tree->nodeCount];
+	node->type = type;
+	node->name = name;
+	node->inputA = inputA;
+	node->inputB = inputB;
+	node->weight = weight;
+	node->mask = mask;
+	node->slerp = true;
+	node->result = NULL;
+	if(type != BLEND_SOURCE) {
+		node->result = createPoseBuffer(tree->count);
+	}
+	node->time = 0.0;
+	node->evaluations = 0;
+	return tree->nodeCount++;
+}
+
+int addSourceNode(BlendTree* tree, const char* name, PoseBuffer* source)
+{
+	int n = addNode(tree, BLEND_SOURCE, name, -1, -1, 1.0f, NULL);
+	if(n >= 0) {
+		tree->nodes[n].result = source;
+	}
+	return n;
+}
+
+int addLerpNode(BlendTree* tree, const char* name, int inputA, int inputB, float weight, const float* mask)
+{
+	return addNode(tree, BLEND_LERP, name, inputA, inputB, weight, mask);
+}
+
+int addAdditiveNode(BlendTree* tree, const char* name, int base, int additive, float weight, const float* mask)
+{
+	return addNode(tree, BLEND_ADDITIVE, name, base, additive, weight, mask);
+}
+
+const PoseBuffer* evaluateBlendTree(BlendTree* tree)
+{
+	for(int n = 0; n < tree->nodeCount; n++) {
+		BlendNode* node = &tree->nodes[n];
+		if(node->type == BLEND_SOURCE) {
+			continue;
+		}
+		const PoseBuffer* a = tree->nodes[node->inputA].result;
+		const PoseBuffer* b = tree->nodes[node->inputB].result;
+
+		double start = nowSeconds();
+		if(node->type == BLEND_LERP) {
+			blendPoses(node->result, a, b, node->weight, node->mask, node->slerp);
+		} else {
+			addPoses(node->result, a, b, node->weight, node->mask);
+		}
+		node->time += nowSeconds() - start;
+		node->evaluations++;
+	}
+	return tree->nodes[tree->nodeCount - 1].result;
+}
+
+void printBlendStats(BlendTree* tree)
+{
+	for(int n = 0; n < tree->nodeCount; n++) {
+		BlendNode* node = &tree->nodes[n];
+		if(node->type == BLEND_SOURCE || node->evaluations == 0) {
+			continue;
+		}
+		double perEvaluation = node->time / node->evaluations;
+		printf("  %-12s %-8s %8.2f us/evaluation, %6.2f ns/bone\n", node->name,
+			   node->type == BLEND_LERP ? "lerp" : "additive",
+			   perEvaluation * 1e6, perEvaluation / tree->count * 1e9);
+	}
+}
+
+void resetBlendStats(BlendTree* tree)
+{
+	for(int n = 0; n < tree->nodeCount; n++) {
+		tree->nodes[n].time = 0.0;
+		tree->nodes[n].evaluations = 0;
+	}
+}
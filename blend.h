@@ -0,0 +1,63 @@
+// Vertex Skinning
+// Blending and layering of whole pose buffers.
+
+#ifndef BLEND_H
+#define BLEND_H
+
+#include "pose.h"
+
+#define MAX_BLEND_NODES 16
+
+#define BLEND_SOURCE   0 // a pose filled in by the caller
+#define BLEND_LERP     1 // inputA towards inputB by weight
+#define BLEND_ADDITIVE 2 // inputB's rotation/translation/scale stacked on top of inputA
+
+// Blend between two poses, bone by bone: t = weight * mask[bone] (mask may be NULL).
+// Rotations take the shorter way round; slerp uses a corrected nlerp
+// that stays within about 1e-3 of the true slerp, nlerp skips the correction.
+void blendPoses(PoseBuffer* result, const PoseBuffer* a, const PoseBuffer* b,
+				float weight, const float* mask, bool slerp);
+
+// result = base with additive applied on top, scaled by weight * mask[bone]
+void addPoses(PoseBuffer* result, const PoseBuffer* base, const PoseBuffer* additive,
+			  float weight, const float* mask);
+
+class BlendNode {
+public:
+	int type;
+	const char* name;
+	int inputA, inputB;   // node indices, always lower than this node's
+	float weight;
+	const float* mask;    // one weight per bone in the buffer, NULL for all bones
+	bool slerp;
+	PoseBuffer* result;   // the caller's pose for sources, preallocated scratch otherwise
+
+	// cost accounting
+	double time;
+	int evaluations;
+};
+
+// Nodes are added children first, so evaluating them in order visits inputs
+// before the nodes that use them. The last node added is the output.
+class BlendTree {
+public:
+	int count;           // bones per pose buffer, all instances included
+	int nodeCount;
+	BlendNode nodes[MAX_BLEND_NODES];
+};
+
+BlendTree* createBlendTree(int count);
+void freeBlendTree(BlendTree* tree);
+
+int addSourceNode(BlendTree* tree, const char* name, PoseBuffer* source);
+int addLerpNode(BlendTree* tree, const char* name, int inputA, int inputB, float weight, const float* mask);
+int addAdditiveNode(BlendTree* tree, const char* name, int base, int additive, float weight, const float* mask);
+
+// Evaluates every node without allocating and returns the output pose
+const PoseBuffer* evaluateBlendTree(BlendTree* tree);
+
+// Average time of each blend layer per evaluation and per bone
+void printBlendStats(BlendTree* tree);
+void resetBlendStats(BlendTree* tree);
+
+#endif
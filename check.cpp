@@ -0,0 +1,489 @@
+// Vertex Skinning
+// Conformance and throughput checks for the skinning kernels, built and run by make check.
+// Every variant is compared against a double precision reference on generated meshes and poses,
+// and its speed relative to that reference against the committed JSON baseline.
+// Usage: ./vertexskinning_check [-update] [-threshold percent] [-baseline file]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "skinning.h"
+#include "morph.h"
+#include "pose.h"
+#include "timer.h"
+
+#define CHECK_BASELINE "check_baseline.json"
+#define CHECK_THRESHOLD 15.0 // percent drop in speed over the reference that fails, unless the baseline sets its own
+#define CHECK_ROUNDS 25    // throughput rounds; each times every variant once and the median ratio is kept
+#define CHECK_RUN_SECONDS 0.03 // per variant and round, long enough for a few passes over the mesh
+
+// largest error allowed, relative to max(1, |reference|)
+#define POSITION_TOLERANCE 1e-5
+#define MATRIX_TOLERANCE   1e-6
+
+// two bones per pose: 18 matrices go through the SSE conversion in blocks of 4 and the scalar tail
+#define CHECK_POSES 9
+#define CHECK_MORPHS 3
+
+class CheckMesh {
+public:
+	const char* name;
+	int count;
+	Vertex* original;
+	float* normals;
+	MorphTarget* morphs[CHECK_MORPHS];
+	int morphCount;
+};
+
+// one way of skinning a mesh; morphs says whether it applies the blend shapes
+class Variant {
+public:
+	const char* name;
+	bool morphs;
+	double verticesPerSecond; // median over the rounds
+	double speedup;           // vertices/s over the reference's, timed in the same rounds
+};
+
+static Variant variants[] = {
+	{"reference", true, 0.0, 1.0},            // double precision, below
+	{"helpers", false, 0.0, 0.0},             // skinVerticesHelpers
+	{"skinVertices", false, 0.0, 0.0},
+	{"skinVertices+morphs", true, 0.0, 0.0},  // blend shapes and normals through the same pass
+};
+static const int variantCount = sizeof(variants) / sizeof(variants[0]);
+
+static int failures = 0;
+static int skipped = 0;
+
+static float randomFloat(float lo, float hi)
+{
+	return lo + (hi - lo) * (rand() / (float) RAND_MAX);
+}
+
+static double relativeError(double value, double reference)
+{
+	double scale = fabs(reference) > 1.0 ? fabs(reference) : 1.0;
+	return fabs(value - reference) / scale;
+}
+
+// The scalar reference: dense blend shapes, then (w1M1 + w2M2) * (V - base), all in double
+static void referenceSkin(const CheckMesh* mesh, const float* matrix1, const float* matrix2, const float base[3],
+						  bool morphs, double* positions, double* normals)
+{
+	for(int v = 0; v < mesh->count; v++) {
+		positions[v * 3]     = mesh->original[v].x;
+		positions[v * 3 + 1] = mesh->original[v].y;
+		positions[v * 3 + 2] = mesh->original[v].z;
+		for(int a = 0; a < 3; a++) {
+			normals[v * 3 + a] = mesh->normals[v * 3 + a];
+		}
+	}
+	for(int t = 0; morphs && t < mesh->morphCount; t++) {
+		const MorphTarget* target = mesh->morphs[t];
+		for(int c = 0; c < target->count; c++) {
+			int v = target->indices[c];
+			positions[v * 3]     += (double) target->weight * target->dx[c];
+			positions[v * 3 + 1] += (double) target->weight * target->dy[c];
+			positions[v * 3 + 2] += (double) target->weight * target->dz[c];
+			normals[v * 3]     += (double) target->weight * target->dnx[c];
+			normals[v * 3 + 1] += (double) target->weight * target->dny[c];
+			normals[v * 3 + 2] += (double) target->weight * target->dnz[c];
+		}
+	}
+
+	for(int v = 0; v < mesh->count; v++) {
+		double m[16];
+		for(int i = 0; i < 16; i++) {
+			m[i] = (double) matrix1[i] * mesh->original[v].weight1 + (double) matrix2[i] * mesh->original[v].weight2;
+		}
+		double p[3] = {positions[v * 3] - base[0], positions[v * 3 + 1] - base[1], positions[v * 3 + 2] - base[2]};
+		double n[3] = {normals[v * 3], normals[v * 3 + 1], normals[v * 3 + 2]};
+		for(int a = 0; a < 3; a++) {
+			positions[v * 3 + a] = m[a] * p[0] + m[4 + a] * p[1] + m[8 + a] * p[2] + m[12 + a];
+			normals[v * 3 + a] = m[a] * n[0] + m[4 + a] * n[1] + m[8 + a] * n[2];
+		}
+	}
+}
+
+static void runVariant(int variant, const CheckMesh* mesh, const float* matrix1, const float* matrix2,
+					   const float base[3], Vertex* weighted, float* weightedNormals,
+					   double* referencePositions, double* referenceNormals)
+{
+	MorphTarget* active[MAX_MORPH_TARGETS];
+	switch(variant) {
+		case 0: referenceSkin(mesh, matrix1, matrix2, base, true, referencePositions, referenceNormals); break;
+		case 1: skinVerticesHelpers(mesh->original, weighted, mesh->count, matrix1, matrix2, base); break;
+		case 2: skinVertices(mesh->original, weighted, mesh->count, matrix1, matrix2, base, NULL, 0, NULL, NULL); break;
+		case 3: skinVertices(mesh->original, weighted, mesh->count, matrix1, matrix2, base,
+							 active, gatherActiveMorphs((MorphTarget**) mesh->morphs, mesh->morphCount, active),
+							 mesh->normals, weightedNormals); break;
+	}
+}
+
+// A mesh with two bones' weights and sparse blend shapes that carry normal deltas.
+// The arm is the viewer's cylinder; random meshes scatter vertices and weights.
+static CheckMesh* createCheckMesh(const char* name, int count, bool arm)
+{
+	CheckMesh* mesh = new CheckMesh();
+	mesh->name = name;
+	mesh->count = count;
+	mesh->original = new Vertex[count];
+	mesh->normals = (float *) malloc(count * 3 * sizeof(float));
+	for(int v = 0; v < count; v++) {
+		float x, y, z, w;
+		if(arm) {
+			int row = v / 37, column = v % 37;
+			x = 1.75f * sin(column * 10 * M_PI / 180);
+			y = 0.5f * row;
+			z = 1.75f * cos(column * 10 * M_PI / 180);
+			w = y < 4.0f ? 0.0f : (y > 6.0f ? 1.0f : (y - 4.0f) / 2.0f);
+		} else {
+			x = randomFloat(-10, 10);
+			y = randomFloat(-10, 10);
+			z = randomFloat(-10, 10);
+			w = randomFloat(0, 1);
+		}
+		mesh->original[v] = Vertex(x, y, z, 0, 1, w, 1.0f - w);
+		float length = sqrt(x * x + z * z) + 1e-6f;
+		mesh->normals[v * 3] = x / length;
+		mesh->normals[v * 3 + 1] = 0.0f;
+		mesh->normals[v * 3 + 2] = z / length;
+	}
+
+	// each target moves about 5% of the vertices
+	float* positionDeltas = (float *) malloc(count * 3 * sizeof(float));
+	float* normalDeltas = (float *) malloc(count * 3 * sizeof(float));
+	mesh->morphCount = CHECK_MORPHS;
+	for(int t = 0; t < CHECK_MORPHS; t++) {
+		for(int v = 0; v < count; v++) {
+			bool moved = rand() % 20 == 0;
+			for(int i = v * 3; i < v * 3 + 3; i++) {
+				positionDeltas[i] = moved ? randomFloat(-0.5f, 0.5f) : 0.0f;
+				normalDeltas[i] = moved ? randomFloat(-0.2f, 0.2f) : 0.0f;
+			}
+		}
+		mesh->morphs[t] = createMorphTarget("check", positionDeltas, normalDeltas, count, 0.0f);
+		mesh->morphs[t]->weight = randomFloat(0.1f, 1.0f);
+	}
+	free(positionDeltas);
+	free(normalDeltas);
+	return mesh;
+}
+
+static void freeCheckMesh(CheckMesh* mesh)
+{
+	for(int t = 0; t < mesh->morphCount; t++) {
+		freeMorphTarget(mesh->morphs[t]);
+	}
+	delete[] mesh->original;
+	free(mesh->normals);
+	delete mesh;
+}
+
+// Two bone matrices per pose, the way the viewer builds them: euler angles to quaternions to T*R*S.
+// Pose 0 is the rest pose.
+static void createPoseMatrices(float* matrices)
+{
+	PoseBuffer* pose = createPoseBuffer(CHECK_POSES * 2);
+	float x[CHECK_POSES * 2], y[CHECK_POSES * 2], z[CHECK_POSES * 2];
+	for(int i = 0; i < CHECK_POSES * 2; i++) {
+		bool rest = i < 2;
+		x[i] = rest ? 0.0f : randomFloat(-180, 180);
+		y[i] = rest ? 0.0f : randomFloat(-180, 180);
+		z[i] = rest ? 0.0f : randomFloat(-180, 180);
+		pose->tx[i] = rest ? 0.0f : randomFloat(-5, 5);
+		pose->ty[i] = rest ? 0.0f : randomFloat(-5, 5);
+		pose->tz[i] = rest ? 0.0f : randomFloat(-5, 5);
+		pose->sx[i] = rest ? 1.0f : randomFloat(0.5f, 2.0f);
+		pose->sy[i] = rest ? 1.0f : randomFloat(0.5f, 2.0f);
+		pose->sz[i] = rest ? 1.0f : randomFloat(0.5f, 2.0f);
+	}
+	eulerToQuaternions(x, y, z, pose->qx, pose->qy, pose->qz, pose->qw, CHECK_POSES * 2);
+	poseToMatrices(pose, matrices);
+
+	// the batch conversion against the per-bone path it replaced, which leaves the translation out
+	double maxError = 0.0;
+	for(int i = 0; i < CHECK_POSES * 2; i++) {
+		float reference[16];
+		eulerToMatrixReference(x[i], y[i], z[i], pose->sx[i], pose->sy[i], pose->sz[i], reference);
+		for(int k = 0; k < 12; k++) {
+			double error = relativeError(matrices[i * 16 + k], reference[k]);
+			if(error > maxError) {
+				maxError = error;
+			}
+		}
+	}
+	bool pass = maxError <= MATRIX_TOLERANCE;
+	printf("%-4s poseToMatrices: max error %.3g against eulerToMatrixReference\n", pass ? "ok" : "FAIL", maxError);
+	failures += pass ? 0 : 1;
+	freePoseBuffer(pose);
+}
+
+// multMatrixByMatrix accumulates in double but multiplies in float, so each element is held
+// to float rounding of its terms: error relative to sum |a * b| rather than to the result
+static void checkMatrixProduct()
+{
+	double maxError = 0.0;
+	for(int r = 0; r < 1000; r++) {
+		float a[16], b[16];
+		for(int i = 0; i < 16; i++) {
+			a[i] = randomFloat(-10, 10);
+			b[i] = randomFloat(-10, 10);
+		}
+		float* product = multMatrixByMatrix(a, b);
+		for(int i = 0; i < 4; i++) {
+			for(int j = 0; j < 4; j++) {
+				double sum = 0.0, magnitude = 0.0;
+				for(int k = 0; k < 4; k++) {
+					sum += (double) a[i + k * 4] * b[j * 4 + k];
+					magnitude += fabs((double) a[i + k * 4] * b[j * 4 + k]);
+				}
+				double error = fabs(product[i + j * 4] - sum) / (magnitude > 1.0 ? magnitude : 1.0);
+				if(error > maxError) {
+					maxError = error;
+				}
+			}
+		}
+		free(product);
+	}
+	bool pass = maxError <= MATRIX_TOLERANCE;
+	printf("%-4s multMatrixByMatrix: max error %.3g against a double product, relative to the terms\n", pass ? "ok" : "FAIL", maxError);
+	failures += pass ? 0 : 1;
+}
+
+// Every variant on every pose against the reference skinned the same way
+static void checkConformance(const CheckMesh* mesh, const float* matrices)
+{
+	Vertex* weighted = new Vertex[mesh->count];
+	float* weightedNormals = (float *) malloc(mesh->count * 3 * sizeof(float));
+	double* positions = (double *) malloc(mesh->count * 3 * sizeof(double));
+	double* normals = (double *) malloc(mesh->count * 3 * sizeof(double));
+	float base[3] = {0.0f, 5.0f, 0.0f};
+
+	for(int variant = 1; variant < variantCount; variant++) {
+		bool morphs = variants[variant].morphs;
+		double maxError = 0.0, maxNormalError = 0.0;
+		for(int p = 0; p < CHECK_POSES; p++) {
+			const float* matrix1 = matrices + p * 32;
+			const float* matrix2 = matrix1 + 16;
+			referenceSkin(mesh, matrix1, matrix2, base, morphs, positions, normals);
+			runVariant(variant, mesh, matrix1, matrix2, base, weighted, weightedNormals, NULL, NULL);
+			for(int v = 0; v < mesh->count; v++) {
+				const float position[3] = {weighted[v].x, weighted[v].y, weighted[v].z};
+				for(int a = 0; a < 3; a++) {
+					double error = relativeError(position[a], positions[v * 3 + a]);
+					if(error > maxError) {
+						maxError = error;
+					}
+					if(morphs) {
+						error = relativeError(weightedNormals[v * 3 + a], normals[v * 3 + a]);
+						if(error > maxNormalError) {
+							maxNormalError = error;
+						}
+					}
+				}
+			}
+		}
+		bool pass = maxError <= POSITION_TOLERANCE && maxNormalError <= POSITION_TOLERANCE;
+		printf("%-4s %s, %s: max position error %.3g", pass ? "ok" : "FAIL", mesh->name, variants[variant].name, maxError);
+		if(morphs) {
+			printf(", normal error %.3g", maxNormalError);
+		}
+		printf("\n");
+		failures += pass ? 0 : 1;
+	}
+
+	delete[] weighted;
+	free(weightedNormals);
+	free(positions);
+	free(normals);
+}
+
+static int compareDoubles(const void* a, const void* b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double median(double* values, int count)
+{
+	qsort(values, count, sizeof(double), compareDoubles);
+	return values[count / 2];
+}
+
+// Each round times every variant back to back, cycling through the poses for CHECK_RUN_SECONDS.
+// A variant's ratio to the reference in the same round cancels whatever else the machine is
+// doing at the time; the median over the rounds drops the rounds that were disturbed anyway.
+static void measureThroughput(const CheckMesh* mesh, const float* matrices)
+{
+	Vertex* weighted = new Vertex[mesh->count];
+	float* weightedNormals = (float *) malloc(mesh->count * 3 * sizeof(float));
+	double* positions = (double *) malloc(mesh->count * 3 * sizeof(double));
+	double* normals = (double *) malloc(mesh->count * 3 * sizeof(double));
+	float base[3] = {0.0f, 5.0f, 0.0f};
+
+	double rates[CHECK_ROUNDS][variantCount];
+	for(int round = 0; round < CHECK_ROUNDS; round++) {
+		for(int variant = 0; variant < variantCount; variant++) {
+			long long vertices = 0;
+			double start = nowSeconds();
+			double elapsed = 0.0;
+			for(int p = 0; elapsed < CHECK_RUN_SECONDS; p = (p + 1) % CHECK_POSES) {
+				runVariant(variant, mesh, matrices + p * 32, matrices + p * 32 + 16, base,
+						   weighted, weightedNormals, positions, normals);
+				vertices += mesh->count;
+				elapsed = nowSeconds() - start;
+			}
+			rates[round][variant] = vertices / elapsed;
+		}
+	}
+
+	for(int variant = 0; variant < variantCount; variant++) {
+		double values[CHECK_ROUNDS];
+		for(int round = 0; round < CHECK_ROUNDS; round++) {
+			values[round] = rates[round][variant];
+		}
+		variants[variant].verticesPerSecond = median(values, CHECK_ROUNDS);
+		for(int round = 0; round < CHECK_ROUNDS; round++) {
+			values[round] = rates[round][variant] / rates[round][0];
+		}
+		variants[variant].speedup = median(values, CHECK_ROUNDS);
+	}
+
+	delete[] weighted;
+	free(weightedNormals);
+	free(positions);
+	free(normals);
+}
+
+static bool writeBaseline(const char* path, double threshold)
+{
+	FILE* file = fopen(path, "w");
+	if(file == NULL) {
+		return false;
+	}
+	fprintf(file, "{\n  \"threshold_percent\": %.1f,\n  \"speedup_over_reference\": {\n", threshold);
+	for(int i = 1; i < variantCount; i++) {
+		fprintf(file, "    \"%s\": %.3f%s\n", variants[i].name, variants[i].speedup,
+				i + 1 < variantCount ? "," : "");
+	}
+	fprintf(file, "  }\n}\n");
+	return fclose(file) == 0;
+}
+
+// Reads the whole baseline; the values are found by their quoted keys
+static char* readFile(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if(file == NULL) {
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	char* text = (char *) malloc(size + 1);
+	size_t length = fread(text, 1, size, file);
+	text[length] = '\0';
+	fclose(file);
+	return text;
+}
+
+static bool findValue(const char* text, const char* name, double* value)
+{
+	char key[64];
+	snprintf(key, sizeof(key), "\"%s\":", name);
+	const char* found = strstr(text, key);
+	if(found == NULL) {
+		return false;
+	}
+	*value = strtod(found + strlen(key), NULL);
+	return true;
+}
+
+static void checkThroughput(const char* path, bool update, double threshold)
+{
+	printf("     reference: %.2f M vertices/s\n", variants[0].verticesPerSecond / 1e6);
+	char* baseline = update ? NULL : readFile(path);
+	if(baseline == NULL) {
+		for(int i = 1; i < variantCount; i++) {
+			printf("     %s: %.2f M vertices/s, %.3fx the reference\n",
+				   variants[i].name, variants[i].verticesPerSecond / 1e6, variants[i].speedup);
+		}
+		if(!writeBaseline(path, threshold < 0.0 ? CHECK_THRESHOLD : threshold)) {
+			printf("FAIL could not write throughput baseline %s\n", path);
+			failures++;
+		} else if(update) {
+			printf("wrote throughput baseline %s\n", path);
+		} else {
+			printf("SKIP throughput: no baseline at %s, wrote one from this run\n", path);
+			skipped++;
+		}
+		return;
+	}
+
+	if(threshold < 0.0 && !findValue(baseline, "threshold_percent", &threshold)) {
+		threshold = CHECK_THRESHOLD;
+	}
+	for(int i = 1; i < variantCount; i++) {
+		double expected;
+		double current = variants[i].speedup;
+		if(!findValue(baseline, variants[i].name, &expected) || expected <= 0.0) {
+			printf("SKIP %s: %.3fx the reference, not in %s (rerun with -update)\n", variants[i].name, current, path);
+			skipped++;
+			continue;
+		}
+		double change = (current / expected - 1.0) * 100.0;
+		bool pass = change >= -threshold;
+		printf("%-4s %s: %.2f M vertices/s, %.3fx the reference, baseline %.3fx (%+.1f%%, threshold -%.0f%%)\n",
+			   pass ? "ok" : "FAIL", variants[i].name, variants[i].verticesPerSecond / 1e6,
+			   current, expected, change, threshold);
+		failures += pass ? 0 : 1;
+	}
+	free(baseline);
+}
+
+int main(int argc, char** argv)
+{
+	const char* baselinePath = CHECK_BASELINE;
+	bool update = false;
+	double threshold = -1.0; // from the baseline
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-update") == 0) {
+			update = true;
+		} else if(strcmp(argv[i], "-threshold") == 0 && i + 1 < argc) {
+			threshold = atof(argv[++i]);
+		} else if(strcmp(argv[i], "-baseline") == 0 && i + 1 < argc) {
+			baselinePath = argv[++i];
+		} else {
+			printf("usage: %s [-update] [-threshold percent] [-baseline file]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	srand(1);
+	float matrices[CHECK_POSES * 2 * 16];
+	createPoseMatrices(matrices);
+	checkMatrixProduct();
+
+	CheckMesh* arm = createCheckMesh("arm", 22 * 37, true);
+	CheckMesh* cloud = createCheckMesh("random", 200000, false);
+	checkConformance(arm, matrices);
+	checkConformance(cloud, matrices);
+
+	measureThroughput(cloud, matrices);
+	checkThroughput(baselinePath, update, threshold);
+
+	freeCheckMesh(arm);
+	freeCheckMesh(cloud);
+
+	if(failures == 0 && skipped > 0) {
+		printf("all checks run passed, %d skipped\n", skipped);
+	} else if(failures == 0) {
+		printf("all checks passed\n");
+	} else {
+		printf("%d checks failed\n", failures);
+	}
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,110 @@
+// Vertex Skinning
+// Line buffer for skeleton gizmos, filled from world matrices and drawn with a single call.
+
+#include "debugdraw.h"
+#include <stdlib.h>
+
+// the axis object, as pairs of line end points
+static const float axisLines[18][3] = {
+	{-1.0f,  0.0f, 0.0f}, { 1.0f,  0.0f, 0.0f},	// X AXIS
+	{ 1.0f,  0.0f, 0.0f}, { 0.9f,  0.1f, 0.0f},	// TOP PIECE OF ARROWHEAD
+	{ 1.0f,  0.0f, 0.0f}, { 0.9f, -0.1f, 0.0f},	// BOTTOM PIECE OF ARROWHEAD
+
+	{ 0.0f,  1.0f, 0.0f}, { 0.0f, -1.0f, 0.0f},	// Y AXIS
+	{ 0.0f,  1.0f, 0.0f}, { 0.1f,  0.9f, 0.0f},
+	{ 0.0f,  1.0f, 0.0f}, {-0.1f,  0.9f, 0.0f},
+
+	{ 0.0f,  0.0f, 1.0f}, { 0.0f,  0.0f, -1.0f},	// Z AXIS
+	{ 0.0f,  0.0f, 1.0f}, { 0.0f,  0.1f, 0.9f},
+	{ 0.0f,  0.0f, 1.0f}, { 0.0f, -0.1f, 0.9f}
+};
+
+static const unsigned char axisColors[3][4] = {
+	{255, 0, 0, 255},	// X - RED
+	{0, 255, 0, 255},	// Y - GREEN
+	{51, 51, 255, 255}	// Z - BLUE
+};
+
+// the bone shape as one line strip; the base vertex is moved to the child's offset
+#define BONE_STRIP_LENGTH 14
+#define BONE_BASE -1.0f
+static const float boneStrip[BONE_STRIP_LENGTH][3] = {
+	{ 0.0f, 0.4f, 0.0f},      // 0
+	{-0.4f, 0.0f,-0.4f},      // 1
+	{ 0.4f, 0.0f,-0.4f},      // 2
+	{ 0.0f, BONE_BASE, 0.0f}, // Base
+	{-0.4f, 0.0f,-0.4f},      // 1
+	{-0.4f, 0.0f, 0.4f},      // 4
+	{ 0.0f, 0.4f, 0.0f},      // 0
+	{ 0.4f, 0.0f,-0.4f},      // 2
+	{ 0.4f, 0.0f, 0.4f},      // 3
+	{ 0.0f, 0.4f, 0.0f},      // 0
+	{-0.4f, 0.0f, 0.4f},      // 4
+	{ 0.0f, BONE_BASE, 0.0f}, // Base
+	{ 0.4f, 0.0f, 0.4f},      // 3
+	{-0.4f, 0.0f, 0.4f}       // 4
+};
+
+static const unsigned char boneColor[4] = {224, 224, 0, 255};
+
+DebugLines* createDebugLines(int capacity)
+{
+	DebugLines* lines = new DebugLines();
+	lines->capacity = capacity;
+	lines->count = 0;
+	lines->positions = (float *) malloc(capacity * 3 * sizeof(float));
+	lines->colors = (unsigned char *) malloc(capacity * 4);
+
+	// every bone writes the same color pattern, so it is filled once here
+	// and appending only has to write positions
+	for(int v = 0; v < capacity; v++) {
+		int i = v % DEBUG_LINES_PER_BONE;
+		const unsigned char* color = i < 18 ? axisColors[i / 6] : boneColor;
+		for(int c = 0; c < 4; c++) {
+			lines->colors[v * 4 + c] = color[c];
+		}
+	}
+	return lines;
+}
+
+void freeDebugLines(DebugLines* lines)
+{
+	free(lines->positions);
+	free(lines->colors);
+	delete lines;
+}
+
+void clearDebugLines(DebugLines* lines)
+{
+	lines->count = 0;
+}
+
+static inline void addVertex(DebugLines* lines, const float* m, float x, float y, float z)
+{
+	float* p = lines->positions + lines->count * 3;
+	p[0] = m[0] * x + m[4] * y + m[8] * z + m[12];
+	p[1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+	p[2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+	lines->count++;
+}
+
+bool appendSkeletonLines(DebugLines* lines, const float* worldMatrices, const float* boneLengths, int boneCount)
+{
+	if(lines->count + boneCount * DEBUG_LINES_PER_BONE > lines->capacity) {
+		return false;
+	}
+	for(int b = 0; b < boneCount; b++) {
+		const float* m = worldMatrices + b * 16;
+		for(int i = 0; i < 18; i++) {
+			addVertex(lines, m, axisLines[i][0], axisLines[i][1], axisLines[i][2]);
+		}
+		// strip to segments: every inner vertex ends one line and starts the next
+		for(int i = 0; i + 1 < BONE_STRIP_LENGTH; i++) {
+			for(int k = i; k <= i + 1; k++) {
+				float y = boneStrip[k][1] == BONE_BASE ? boneLengths[b] : boneStrip[k][1];
+				addVertex(lines, m, boneStrip[k][0], y, boneStrip[k][2]);
+			}
+		}
+	}
+	return true;
+}
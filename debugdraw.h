@@ -0,0 +1,27 @@
+// Vertex Skinning
+// Line buffer for skeleton gizmos, filled from world matrices and drawn with a single call.
+
+#ifndef DEBUGDRAW_H
+#define DEBUGDRAW_H
+
+// vertices one bone adds: 9 axis segments and 13 segments of the bone shape
+#define DEBUG_LINES_PER_BONE 44
+
+class DebugLines {
+public:
+	int capacity;           // vertices
+	int count;
+	float* positions;       // 3 per vertex, pairs form GL_LINES
+	unsigned char* colors;  // RGBA per vertex, the same for every bone so set up front
+};
+
+DebugLines* createDebugLines(int capacity);
+void freeDebugLines(DebugLines* lines);
+void clearDebugLines(DebugLines* lines);
+
+// Appends the axis gizmo and the bone shape of every bone, transformed by its
+// model space matrix. boneLengths is the child's offset along y (negative points down).
+// Returns false, adding nothing, if the buffer has no room left.
+bool appendSkeletonLines(DebugLines* lines, const float* worldMatrices, const float* boneLengths, int boneCount);
+
+#endif
@@ -0,0 +1,96 @@
+// Vertex Skinning
+// Sparse blend shapes (morph targets) applied to the rest mesh before skinning.
+
+#include "morph.h"
+#include <math.h>
+#include <stdlib.h>
+
+MorphTarget* createMorphTarget(const char* name, const float* positionDeltas, const float* normalDeltas,
+							   int vertexCount, float threshold)
+{
+	MorphTarget* target = new MorphTarget();
+	target->name = name;
+	target->weight = 0.0f;
+	target->driverAngle = NULL;
+	target->driverStart = 0.0f;
+	target->driverEnd = 0.0f;
+
+	int count = 0;
+	for(int i = 0; i < vertexCount; i++) {
+		const float* d = positionDeltas + i * 3;
+		if(sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) > threshold) {
+			count++;
+		}
+	}
+
+	target->count = count;
+	target->indices = (int *) malloc(count * sizeof(int));
+	target->dx = (float *) malloc(count * sizeof(float));
+	target->dy = (float *) malloc(count * sizeof(float));
+	target->dz = (float *) malloc(count * sizeof(float));
+	target->dnx = NULL;
+	target->dny = NULL;
+	target->dnz = NULL;
+	if(normalDeltas != NULL) {
+		target->dnx = (float *) malloc(count * sizeof(float));
+		target->dny = (float *) malloc(count * sizeof(float));
+		target->dnz = (float *) malloc(count * sizeof(float));
+	}
+
+	// walking the dense array in order keeps the indices sorted
+	int n = 0;
+	for(int i = 0; i < vertexCount; i++) {
+		const float* d = positionDeltas + i * 3;
+		if(sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) <= threshold) {
+			continue;
+		}
+		target->indices[n] = i;
+		target->dx[n] = d[0];
+		target->dy[n] = d[1];
+		target->dz[n] = d[2];
+		if(normalDeltas != NULL) {
+			target->dnx[n] = normalDeltas[i * 3];
+			target->dny[n] = normalDeltas[i * 3 + 1];
+			target->dnz[n] = normalDeltas[i * 3 + 2];
+		}
+		n++;
+	}
+	return target;
+}
+
+void freeMorphTarget(MorphTarget* target)
+{
+	free(target->indices);
+	free(target->dx);
+	free(target->dy);
+	free(target->dz);
+	free(target->dnx);
+	free(target->dny);
+	free(target->dnz);
+	delete target;
+}
+
+void setMorphDriver(MorphTarget* target, const float* angle, float start, float end)
+{
+	target->driverAngle = angle;
+	target->driverStart = start;
+	target->driverEnd = end;
+}
+
+int gatherActiveMorphs(MorphTarget** targets, int count, MorphTarget** active)
+{
+	int activeCount = 0;
+	for(int i = 0; i < count; i++) {
+		MorphTarget* target = targets[i];
+		if(target->driverAngle != NULL && target->driverEnd != target->driverStart) {
+			float t = (*target->driverAngle - target->driverStart) / (target->driverEnd - target->driverStart);
+			if(t < 0.0f) t = 0.0f;
+			if(t > 1.0f) t = 1.0f;
+			target->weight = t;
+		}
+		if(target->weight != 0.0f && target->count > 0 && activeCount < MAX_MORPH_TARGETS) {
+			active[activeCount++] = target;
+		}
+	}
+	return activeCount;
+}
@@ -0,0 +1,37 @@
+// Vertex Skinning
+// Sparse blend shapes (morph targets) applied to the rest mesh before skinning.
+
+#ifndef MORPH_H
+#define MORPH_H
+
+#define MAX_MORPH_TARGETS 16
+
+class MorphTarget {
+public:
+	const char* name;
+	float weight;
+
+	// only the vertices that actually move are stored, indices sorted ascending
+	int count;
+	int* indices;
+	float *dx, *dy, *dz;    // position deltas
+	float *dnx, *dny, *dnz; // normal deltas, NULL if the target has none
+
+	// optional driver: weight goes 0..1 while *driverAngle moves from driverStart to driverEnd (degrees)
+	const float* driverAngle;
+	float driverStart, driverEnd;
+};
+
+// Builds a target out of dense per-vertex deltas (3 floats per vertex), keeping
+// the vertices whose position delta is longer than threshold. normalDeltas may be NULL.
+MorphTarget* createMorphTarget(const char* name, const float* positionDeltas, const float* normalDeltas,
+							   int vertexCount, float threshold);
+void freeMorphTarget(MorphTarget* target);
+
+void setMorphDriver(MorphTarget* target, const float* angle, float start, float end);
+
+// Evaluates the drivers and writes the targets with a non-zero weight into active.
+// Returns how many there are; targets with zero weight are never looked at by the skinning pass.
+int gatherActiveMorphs(MorphTarget** targets, int count, MorphTarget** active);
+
+#endif
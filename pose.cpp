@@ -0,0 +1,325 @@
+// Vertex Skinning
+// Local bone poses stored as translation/rotation/scale arrays, and batch conversion to matrices.
+
+#include "pose.h"
+#include "skinning.h"
+#include <math.h>
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define DEG_TO_HALF_RAD (M_PI / 360.0)
+
+PoseBuffer* createPoseBuffer(int count)
+{
+	PoseBuffer* pose = new PoseBuffer();
+	pose->count = count;
+	// one block for all ten channels
+	float* data = (float *) malloc(10 * count * sizeof(float));
+	pose->qx = data;
+	pose->qy = data + count;
+	pose->qz = data + 2 * count;
+	pose->qw = data + 3 * count;
+	pose->tx = data + 4 * count;
+	pose->ty = data + 5 * count;
+	pose->tz = data + 6 * count;
+	pose->sx = data + 7 * count;
+	pose->sy = data + 8 * count;
+	pose->sz = data + 9 * count;
+	setPoseIdentity(pose);
+	return pose;
+}
+
+void freePoseBuffer(PoseBuffer* pose)
+{
+	free(pose->qx);
+	delete pose;
+}
+
+void setPoseIdentity(PoseBuffer* pose)
+{
+	for(int i = 0; i < pose->count; i++) {
+		pose->qx[i] = 0.0f;
+		pose->qy[i] = 0.0f;
+		pose->qz[i] = 0.0f;
+		pose->qw[i] = 1.0f;
+		pose->tx[i] = 0.0f;
+		pose->ty[i] = 0.0f;
+		pose->tz[i] = 0.0f;
+		pose->sx[i] = 1.0f;
+		pose->sy[i] = 1.0f;
+		pose->sz[i] = 1.0f;
+	}
+}
+
+void copyPose(PoseBuffer* destination, const PoseBuffer* source)
+{
+	int count = destination->count < source->count ? destination->count : source->count;
+	for(int i = 0; i < count; i++) {
+		destination->qx[i] = source->qx[i];
+		destination->qy[i] = source->qy[i];
+		destination->qz[i] = source->qz[i];
+		destination->qw[i] = source->qw[i];
+		destination->tx[i] = source->tx[i];
+		destination->ty[i] = source->ty[i];
+		destination->tz[i] = source->tz[i];
+		destination->sx[i] = source->sx[i];
+		destination->sy[i] = source->sy[i];
+		destination->sz[i] = source->sz[i];
+	}
+}
+
+// q = qz * qy * qx from the half angle sines and cosines
+static inline void eulerQuaternion(float sx, float cx, float sy, float cy, float sz, float cz,
+								   float* qx, float* qy, float* qz, float* qw)
+{
+	*qx = cz * cy * sx - sz * cx * sy;
+	*qy = cz * cx * sy + sz * cy * sx;
+	*qz = sz * cx * cy - cz * sx * sy;
+	*qw = cz * cx * cy + sz * sx * sy;
+}
+
+#ifdef __SSE2__
+// sin and cos of four floats at once (Cephes polynomials, about 1e-7 absolute error)
+static inline void sincos4(__m128 x, __m128* s, __m128* c)
+{
+	const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+	__m128 sinSign = _mm_and_ps(x, signMask);
+	x = _mm_andnot_ps(signMask, x);
+
+	// octant, rounded up to even
+	__m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.27323954473516f))); // 4 / pi
+	j = _mm_add_epi32(j, _mm_set1_epi32(1));
+	j = _mm_and_si128(j, _mm_set1_epi32(~1));
+	__m128 y = _mm_cvtepi32_ps(j);
+
+	__m128 swapSinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29));
+	__m128 polyMask = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), _mm_setzero_si128()));
+	__m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(
+		_mm_andnot_si128(_mm_sub_epi32(j, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+	sinSign = _mm_xor_ps(sinSign, swapSinSign);
+
+	// x - y * pi / 4 in three steps to keep the precision
+	x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(-0.78515625f)));
+	x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(-2.4187564849853515625e-4f)));
+	x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(-3.77489497744594108e-8f)));
+	__m128 z = _mm_mul_ps(x, x);
+
+	__m128 cosPoly = _mm_set1_ps(2.443315711809948e-5f);
+	cosPoly = _mm_add_ps(_mm_mul_ps(cosPoly, z), _mm_set1_ps(-1.388731625493765e-3f));
+	cosPoly = _mm_add_ps(_mm_mul_ps(cosPoly, z), _mm_set1_ps(4.166664568298827e-2f));
+	cosPoly = _mm_mul_ps(_mm_mul_ps(cosPoly, z), z);
+	cosPoly = _mm_sub_ps(cosPoly, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+	cosPoly = _mm_add_ps(cosPoly, _mm_set1_ps(1.0f));
+
+	__m128 sinPoly = _mm_set1_ps(-1.9515295891e-4f);
+	sinPoly = _mm_add_ps(_mm_mul_ps(sinPoly, z), _mm_set1_ps(8.3321608736e-3f));
+	sinPoly = _mm_add_ps(_mm_mul_ps(sinPoly, z), _mm_set1_ps(-1.6666654611e-1f));
+	sinPoly = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sinPoly, z), x), x);
+
+	// the octant decides which polynomial is the sine
+	__m128 sinResult = _mm_or_ps(_mm_and_ps(polyMask, sinPoly), _mm_andnot_ps(polyMask, cosPoly));
+	__m128 cosResult = _mm_or_ps(_mm_and_ps(polyMask, cosPoly), _mm_andnot_ps(polyMask, sinPoly));
+	*s = _mm_xor_ps(sinResult, sinSign);
+	*c = _mm_xor_ps(cosResult, cosSign);
+}
+#endif
+
+void eulerToQuaternions(const float* x, const float* y, const float* z,
+						float* qx, float* qy, float* qz, float* qw, int count)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128 halfRadians = _mm_set1_ps((float) DEG_TO_HALF_RAD);
+	for(; i + 4 <= count; i += 4) {
+		__m128 sx, cx, sy, cy, sz, cz;
+		sincos4(_mm_mul_ps(_mm_loadu_ps(x + i), halfRadians), &sx, &cx);
+		sincos4(_mm_mul_ps(_mm_loadu_ps(y + i), halfRadians), &sy, &cy);
+		sincos4(_mm_mul_ps(_mm_loadu_ps(z + i), halfRadians), &sz, &cz);
+
+		__m128 czcy = _mm_mul_ps(cz, cy);
+		__m128 szsy = _mm_mul_ps(sz, sy);
+		__m128 czsy = _mm_mul_ps(cz, sy);
+		__m128 szcy = _mm_mul_ps(sz, cy);
+		_mm_storeu_ps(qx + i, _mm_sub_ps(_mm_mul_ps(czcy, sx), _mm_mul_ps(szsy, cx)));
+		_mm_storeu_ps(qy + i, _mm_add_ps(_mm_mul_ps(czsy, cx), _mm_mul_ps(szcy, sx)));
+		_mm_storeu_ps(qz + i, _mm_sub_ps(_mm_mul_ps(szcy, cx), _mm_mul_ps(czsy, sx)));
+		_mm_storeu_ps(qw + i, _mm_add_ps(_mm_mul_ps(czcy, cx), _mm_mul_ps(szsy, sx)));
+	}
+#endif
+	for(; i < count; i++) {
+		float ax = x[i] * DEG_TO_HALF_RAD;
+		float ay = y[i] * DEG_TO_HALF_RAD;
+		float az = z[i] * DEG_TO_HALF_RAD;
+		eulerQuaternion(sinf(ax), cosf(ax), sinf(ay), cosf(ay), sinf(az), cosf(az), qx + i, qy + i, qz + i, qw + i);
+	}
+}
+
+void poseToMatrices(const PoseBuffer* pose, float* matrices)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 zero = _mm_setzero_ps();
+	for(; i + 4 <= pose->count; i += 4) {
+		__m128 x = _mm_loadu_ps(pose->qx + i);
+		__m128 y = _mm_loadu_ps(pose->qy + i);
+		__m128 z = _mm_loadu_ps(pose->qz + i);
+		__m128 w = _mm_loadu_ps(pose->qw + i);
+		__m128 sx = _mm_loadu_ps(pose->sx + i);
+		__m128 sy = _mm_loadu_ps(pose->sy + i);
+		__m128 sz = _mm_loadu_ps(pose->sz + i);
+
+		__m128 x2 = _mm_mul_ps(x, two), y2 = _mm_mul_ps(y, two), z2 = _mm_mul_ps(z, two);
+		__m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+		__m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+		__m128 wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+
+		// one register per matrix element, four bones wide
+		__m128 m[16];
+		m[0]  = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx);
+		m[1]  = _mm_mul_ps(_mm_add_ps(xy, wz), sx);
+		m[2]  = _mm_mul_ps(_mm_sub_ps(xz, wy), sx);
+		m[3]  = zero;
+		m[4]  = _mm_mul_ps(_mm_sub_ps(xy, wz), sy);
+		m[5]  = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy);
+		m[6]  = _mm_mul_ps(_mm_add_ps(yz, wx), sy);
+		m[7]  = zero;
+		m[8]  = _mm_mul_ps(_mm_add_ps(xz, wy), sz);
+		m[9]  = _mm_mul_ps(_mm_sub_ps(yz, wx), sz);
+		m[10] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz);
+		m[11] = zero;
+		m[12] = _mm_loadu_ps(pose->tx + i);
+		m[13] = _mm_loadu_ps(pose->ty + i);
+		m[14] = _mm_loadu_ps(pose->tz + i);
+		m[15] = one;
+
+		// transpose each column so every bone gets its own contiguous matrix
+		float* out = matrices + i * 16;
+		for(int column = 0; column < 4; column++) {
+			__m128 c0 = m[column * 4], c1 = m[column * 4 + 1], c2 = m[column * 4 + 2], c3 = m[column * 4 + 3];
+			_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+			_mm_storeu_ps(out + column * 4, c0);
+			_mm_storeu_ps(out + 16 + column * 4, c1);
+			_mm_storeu_ps(out + 32 + column * 4, c2);
+			_mm_storeu_ps(out + 48 + column * 4, c3);
+		}
+	}
+#endif
+	for(; i < pose->count; i++) {
+		float* m = matrices + i * 16;
+		quaternionToMatrix(pose->qx[i], pose->qy[i], pose->qz[i], pose->qw[i], m);
+		for(int row = 0; row < 3; row++) {
+			m[row] *= pose->sx[i];
+			m[4 + row] *= pose->sy[i];
+			m[8 + row] *= pose->sz[i];
+		}
+		m[12] = pose->tx[i];
+		m[13] = pose->ty[i];
+		m[14] = pose->tz[i];
+	}
+}
+
+void localToWorldMatrices(const PoseBuffer* pose, const int* parents, float* worldMatrices)
+{
+	// the chain of translations and rotations first
+	for(int b = 0; b < pose->count; b++) {
+		float local[16];
+		quaternionToMatrix(pose->qx[b], pose->qy[b], pose->qz[b], pose->qw[b], local);
+		local[12] = pose->tx[b];
+		local[13] = pose->ty[b];
+		local[14] = pose->tz[b];
+		float* world = worldMatrices + b * 16;
+		if(parents[b] < 0) {
+			for(int i = 0; i < 16; i++) {
+				world[i] = local[i];
+			}
+			continue;
+		}
+		const float* parent = worldMatrices + parents[b] * 16;
+		for(int column = 0; column < 4; column++) {
+			for(int row = 0; row < 4; row++) {
+				world[column * 4 + row] = parent[row] * local[column * 4]
+										+ parent[4 + row] * local[column * 4 + 1]
+										+ parent[8 + row] * local[column * 4 + 2]
+										+ parent[12 + row] * local[column * 4 + 3];
+			}
+		}
+	}
+	// then each bone's own scale, once no child needs the unscaled matrix any more
+	for(int b = 0; b < pose->count; b++) {
+		float* world = worldMatrices + b * 16;
+		for(int row = 0; row < 3; row++) {
+			world[row] *= pose->sx[b];
+			world[4 + row] *= pose->sy[b];
+			world[8 + row] *= pose->sz[b];
+		}
+	}
+}
+
+void quaternionToMatrix(float x, float y, float z, float w, float* m)
+{
+	m[0]  = 1.0f - 2.0f * (y * y + z * z);
+	m[1]  = 2.0f * (x * y + w * z);
+	m[2]  = 2.0f * (x * z - w * y);
+	m[3]  = 0.0f;
+	m[4]  = 2.0f * (x * y - w * z);
+	m[5]  = 1.0f - 2.0f * (x * x + z * z);
+	m[6]  = 2.0f * (y * z + w * x);
+	m[7]  = 0.0f;
+	m[8]  = 2.0f * (x * z + w * y);
+	m[9]  = 2.0f * (y * z - w * x);
+	m[10] = 1.0f - 2.0f * (x * x + y * y);
+	m[11] = 0.0f;
+	m[12] = 0.0f;
+	m[13] = 0.0f;
+	m[14] = 0.0f;
+	m[15] = 1.0f;
+}
+
+void eulerToMatrixReference(float rx, float ry, float rz, float sx, float sy, float sz, float* matrix)
+{
+	float scaleMatrix[16] = {sx, 0, 0, 0,
+							 0, sy, 0, 0,
+							 0, 0, sz, 0,
+							 0, 0, 0, 1};
+
+	float cosX = cos(rx * M_PI / 180), sinX = sin(rx * M_PI / 180);
+	float cosY = cos(ry * M_PI / 180), sinY = sin(ry * M_PI / 180);
+	float cosZ = cos(rz * M_PI / 180), sinZ = sin(rz * M_PI / 180);
+
+	float rotXMatrix[16] = {1, 0, 0, 0,
+							0, cosX, sinX, 0,
+							0, -sinX, cosX, 0,
+							0, 0, 0, 1};
+	float rotYMatrix[16] = {cosY, 0, -sinY, 0,
+							0, 1, 0, 0,
+							sinY, 0, cosY, 0,
+							0, 0, 0, 1};
+	float rotZMatrix[16] = {cosZ, sinZ, 0, 0,
+							-sinZ, cosZ, 0, 0,
+							0, 0, 1, 0,
+							0, 0, 0, 1};
+
+	float identity[16] = {1, 0, 0, 0,
+						  0, 1, 0, 0,
+						  0, 0, 1, 0,
+						  0, 0, 0, 1};
+
+	float* afterScaling = multMatrixByMatrix(scaleMatrix, identity);
+	float* afterRotX = multMatrixByMatrix(rotXMatrix, afterScaling);
+	float* afterRotY = multMatrixByMatrix(rotYMatrix, afterRotX);
+	float* afterRotZ = multMatrixByMatrix(rotZMatrix, afterRotY);
+
+	free(afterScaling);
+	free(afterRotX);
+	free(afterRotY);
+
+	for(int i = 0; i < 16; i++) {
+		matrix[i] = afterRotZ[i];
+	}
+	free(afterRotZ);
+}
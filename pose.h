@@ -0,0 +1,43 @@
+// Vertex Skinning
+// Local bone poses stored as translation/rotation/scale arrays, and batch conversion to matrices.
+
+#ifndef POSE_H
+#define POSE_H
+
+// One entry per bone, structure of arrays so several bones (and rig instances,
+// laid out one after the other) can be converted at once
+class PoseBuffer {
+public:
+	int count;
+	float *qx, *qy, *qz, *qw; // rotation quaternion
+	float *tx, *ty, *tz;      // translation
+	float *sx, *sy, *sz;      // scale
+};
+
+PoseBuffer* createPoseBuffer(int count);
+void freePoseBuffer(PoseBuffer* pose);
+void setPoseIdentity(PoseBuffer* pose);
+void copyPose(PoseBuffer* destination, const PoseBuffer* source);
+
+// Euler angles in degrees, applied x first, then y, then z (the order drawSkeleton uses).
+// Four bones at a time with a polynomial sincos when SSE2 is available.
+void eulerToQuaternions(const float* x, const float* y, const float* z,
+						float* qx, float* qy, float* qz, float* qw, int count);
+
+// Column major T * R * S for every bone in the pose, 16 floats each, straight from the quaternion
+void poseToMatrices(const PoseBuffer* pose, float* matrices);
+
+// Model space matrices for every bone in the pose: the parents' T * R chained, times the bone's own T * R * S.
+// Scale stays local to its bone, the way glScalef inside a push/pop did, so it never reaches the children.
+// Parents have to come before their children; -1 marks a root.
+void localToWorldMatrices(const PoseBuffer* pose, const int* parents, float* worldMatrices);
+
+// Column major rotation matrix of a unit quaternion
+void quaternionToMatrix(float x, float y, float z, float w, float* matrix);
+
+// The per-bone path the viewer used before: separate rotation matrices and three
+// multMatrixByMatrix products for R = Rz * Ry * Rx * S, no translation.
+// Kept as the reference for the batch conversion.
+void eulerToMatrixReference(float rx, float ry, float rz, float sx, float sy, float sz, float* matrix);
+
+#endif
@@ -0,0 +1,315 @@
+// Vertex Skinning
+// Recorded input sessions, replay frame timings and the regression check against a baseline.
+
+#include "session.h"
+#include "skinning.h"
+#include "timer.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INPUT_SESSION_MAGIC   0x4E495356 // "VSIN"
+#define INPUT_SESSION_VERSION 1
+#define INPUT_EVENT_SIZE      6
+#define CALIBRATION_POINTS    (22 * 37 * 4)
+#define CHECKSUM_TOLERANCE    1e-2
+
+InputSession* createInputSession()
+{
+	InputSession* session = new InputSession();
+	session->count = 0;
+	session->capacity = 64;
+	session->events = (InputEvent *) malloc(session->capacity * sizeof(InputEvent));
+	session->frames = 0;
+	return session;
+}
+
+void freeInputSession(InputSession* session)
+{
+	free(session->events);
+	delete session;
+}
+
+void recordInputEvent(InputSession* session, unsigned int frame, int type, int key)
+{
+	if(session->count == session->capacity) {
+		session->capacity *= 2;
+		session->events = (InputEvent *) realloc(session->events, session->capacity * sizeof(InputEvent));
+	}
+	InputEvent* event = &session->events[session->count++];
+	event->frame = frame;
+	event->type = (unsigned char) type;
+	event->key = (unsigned char) key;
+}
+
+bool saveInputSession(const char* path, const InputSession* session)
+{
+	FILE* file = fopen(path, "wb");
+	if(file == NULL) {
+		return false;
+	}
+	unsigned int header[4] = {INPUT_SESSION_MAGIC, INPUT_SESSION_VERSION,
+							  (unsigned int) session->count, session->frames};
+	bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+	for(int i = 0; ok && i < session->count; i++) {
+		const InputEvent* event = &session->events[i];
+		unsigned char record[INPUT_EVENT_SIZE];
+		memcpy(record, &event->frame, 4);
+		record[4] = event->type;
+		record[5] = event->key;
+		ok = fwrite(record, sizeof(record), 1, file) == 1;
+	}
+	fclose(file);
+	if(!ok) {
+		remove(path);
+	}
+	return ok;
+}
+
+InputSession* loadInputSession(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if(file == NULL) {
+		return NULL;
+	}
+	unsigned int header[4];
+	if(fread(header, sizeof(header), 1, file) != 1
+		|| header[0] != INPUT_SESSION_MAGIC || header[1] != INPUT_SESSION_VERSION) {
+		fclose(file);
+		return NULL;
+	}
+
+	InputSession* session = createInputSession();
+	session->frames = header[3];
+	bool ok = true;
+	for(unsigned int i = 0; ok && i < header[2]; i++) {
+		unsigned char record[INPUT_EVENT_SIZE];
+		ok = fread(record, sizeof(record), 1, file) == 1;
+		if(ok) {
+			unsigned int frame;
+			memcpy(&frame, record, 4);
+			recordInputEvent(session, frame, record[4], record[5]);
+		}
+	}
+	fclose(file);
+	if(!ok) {
+		freeInputSession(session);
+		return NULL;
+	}
+	return session;
+}
+
+FrameTimes* createFrameTimes(int capacity)
+{
+	FrameTimes* frameTimes = new FrameTimes();
+	frameTimes->count = 0;
+	frameTimes->capacity = capacity > 0 ? capacity : 1;
+	frameTimes->times = (double *) malloc(frameTimes->capacity * sizeof(double));
+	frameTimes->calibration = (double *) malloc(frameTimes->capacity * sizeof(double));
+	for(int k = 0; k < CHECKSUM_SUMS; k++) {
+		frameTimes->checksum[k] = 0.0;
+	}
+	frameTimes->checksumState = 1u;
+	return frameTimes;
+}
+
+void freeFrameTimes(FrameTimes* frameTimes)
+{
+	free(frameTimes->times);
+	free(frameTimes->calibration);
+	delete frameTimes;
+}
+
+void addFrameTime(FrameTimes* frameTimes, double seconds, double calibrationSeconds)
+{
+	if(frameTimes->count == frameTimes->capacity) {
+		frameTimes->capacity *= 2;
+		frameTimes->times = (double *) realloc(frameTimes->times, frameTimes->capacity * sizeof(double));
+		frameTimes->calibration = (double *) realloc(frameTimes->calibration, frameTimes->capacity * sizeof(double));
+	}
+	frameTimes->times[frameTimes->count] = seconds;
+	frameTimes->calibration[frameTimes->count] = calibrationSeconds;
+	frameTimes->count++;
+}
+
+void addChecksumVertices(FrameTimes* frameTimes, const Vertex* vertices, int count)
+{
+	unsigned int state = frameTimes->checksumState;
+	for(int i = 0; i < count; i++) {
+		const float position[3] = {vertices[i].x, vertices[i].y, vertices[i].z};
+		for(int c = 0; c < 3; c++) {
+			state = state * 1664525u + 1013904223u; // the high bits are the well mixed ones
+			for(int k = 0; k < CHECKSUM_SUMS; k++) {
+				frameTimes->checksum[k] += (state >> (31 - k)) & 1 ? position[c] : -position[c];
+			}
+		}
+	}
+	frameTimes->checksumState = state;
+}
+
+// A fixed workload that shares nothing with the code being timed: a 4x4 transform of a mesh sized array
+double timeCalibration()
+{
+	static float points[CALIBRATION_POINTS * 3];
+	static float results[CALIBRATION_POINTS * 3];
+	static const float m[16] = {0.8f, 0.6f, 0.0f, 0.0f,  -0.6f, 0.8f, 0.0f, 0.0f,
+								0.0f, 0.0f, 1.0f, 0.0f,   1.0f, 2.0f, 3.0f, 1.0f};
+	double start = nowSeconds();
+	for(int i = 0; i < CALIBRATION_POINTS; i++) {
+		float x = points[i * 3] + results[i * 3 + 2], y = points[i * 3 + 1], z = points[i * 3 + 2];
+		results[i * 3]     = m[0] * x + m[4] * y + m[8] * z + m[12];
+		results[i * 3 + 1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+		results[i * 3 + 2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+		points[i * 3] = results[i * 3 + 1] * 1e-3f;
+	}
+	return nowSeconds() - start;
+}
+
+static int compareDoubles(const void* a, const void* b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// p in [0, 1] of the sorted values
+static double percentile(const double* values, int count, double p)
+{
+	if(count == 0) {
+		return 0.0;
+	}
+	double* sorted = (double *) malloc(count * sizeof(double));
+	memcpy(sorted, values, count * sizeof(double));
+	qsort(sorted, count, sizeof(double), compareDoubles);
+	double value = sorted[(int) (p * (count - 1) + 0.5)];
+	free(sorted);
+	return value;
+}
+
+static double percentile(const FrameTimes* frameTimes, double p)
+{
+	return percentile(frameTimes->times, frameTimes->count, p);
+}
+
+// median frame time in units of the median calibration time
+static double relativeFrameTime(const FrameTimes* frameTimes)
+{
+	double calibration = percentile(frameTimes->calibration, frameTimes->count, 0.5);
+	return calibration > 0.0 ? percentile(frameTimes, 0.5) / calibration : 0.0;
+}
+
+void printFrameTimes(const FrameTimes* frameTimes)
+{
+	double total = 0.0;
+	for(int i = 0; i < frameTimes->count; i++) {
+		total += frameTimes->times[i];
+	}
+	double mean = frameTimes->count > 0 ? total / frameTimes->count : 0.0;
+	printf("replay: %d frames, mean %.4f ms, median %.4f ms, p95 %.4f ms, max %.4f ms\n",
+		   frameTimes->count, mean * 1000.0, percentile(frameTimes, 0.5) * 1000.0,
+		   percentile(frameTimes, 0.95) * 1000.0, percentile(frameTimes, 1.0) * 1000.0);
+	printf("replay: calibration median %.4f ms, frame time %.3fx calibration\n",
+		   percentile(frameTimes->calibration, frameTimes->count, 0.5) * 1000.0, relativeFrameTime(frameTimes));
+}
+
+bool saveFrameTimes(const char* path, const FrameTimes* frameTimes)
+{
+	FILE* file = fopen(path, "w");
+	if(file == NULL) {
+		return false;
+	}
+	fprintf(file, "frame,ms,calibration_ms\n");
+	for(int i = 0; i < frameTimes->count; i++) {
+		fprintf(file, "%d,%.6f,%.6f\n", i, frameTimes->times[i] * 1000.0, frameTimes->calibration[i] * 1000.0);
+	}
+	return fclose(file) == 0;
+}
+
+bool writeReplayChecksum(const char* path, const FrameTimes* frameTimes)
+{
+	FILE* file = fopen(path, "w");
+	if(file == NULL) {
+		return false;
+	}
+	fprintf(file, "frames %d\n", frameTimes->count);
+	fprintf(file, "checksum");
+	for(int k = 0; k < CHECKSUM_SUMS; k++) {
+		fprintf(file, " %.6f", frameTimes->checksum[k]);
+	}
+	fprintf(file, "\n");
+	return fclose(file) == 0;
+}
+
+bool checkReplayChecksum(const char* path, const FrameTimes* frameTimes)
+{
+	FILE* file = fopen(path, "r");
+	if(file == NULL) {
+		printf("replay: could not read checksum %s\n", path);
+		return false;
+	}
+	int frames = 0;
+	double checksum[CHECKSUM_SUMS];
+	bool ok = fscanf(file, " frames %d checksum", &frames) == 1;
+	for(int k = 0; ok && k < CHECKSUM_SUMS; k++) {
+		ok = fscanf(file, "%lf", &checksum[k]) == 1;
+	}
+	fclose(file);
+	if(!ok) {
+		printf("replay: malformed checksum file %s\n", path);
+		return false;
+	}
+	if(frames != frameTimes->count) {
+		printf("replay: output differs (%d frames, expected %d)\n", frameTimes->count, frames);
+		return false;
+	}
+	double maxError = 0.0;
+	for(int k = 0; k < CHECKSUM_SUMS; k++) {
+		maxError = fmax(maxError, fabs(frameTimes->checksum[k] - checksum[k]));
+	}
+	if(maxError > CHECKSUM_TOLERANCE) {
+		printf("replay: output differs (checksum off by %g, tolerance %g)\n", maxError, CHECKSUM_TOLERANCE);
+		return false;
+	}
+	printf("replay: output matches %s (checksum off by %g)\n", path, maxError);
+	return true;
+}
+
+bool writeReplayBaseline(const char* path, const FrameTimes* frameTimes)
+{
+	FILE* file = fopen(path, "w");
+	if(file == NULL) {
+		return false;
+	}
+	fprintf(file, "frames %d\n", frameTimes->count);
+	fprintf(file, "relative %.6f\n", relativeFrameTime(frameTimes));
+	fprintf(file, "median_ms %.6f\n", percentile(frameTimes, 0.5) * 1000.0);
+	return fclose(file) == 0;
+}
+
+bool checkReplayBaseline(const char* path, const FrameTimes* frameTimes, float thresholdPercent)
+{
+	FILE* file = fopen(path, "r");
+	if(file == NULL) {
+		printf("replay: no frame time baseline %s (write one with -write)\n", path);
+		return false;
+	}
+	int frames = 0;
+	double relative = 0.0;
+	bool ok = fscanf(file, " frames %d relative %lf", &frames, &relative) == 2;
+	fclose(file);
+	if(!ok || frames != frameTimes->count) {
+		printf("replay: frame time baseline %s does not match this session\n", path);
+		return false;
+	}
+
+	double current = relativeFrameTime(frameTimes);
+	double change = relative > 0.0 ? (current / relative - 1.0) * 100.0 : 0.0;
+	if(change > thresholdPercent) {
+		printf("replay: frame time regressed %.1f%% (%.3fx calibration, baseline %.3fx, threshold %.1f%%)\n",
+			   change, current, relative, thresholdPercent);
+		return false;
+	}
+	printf("replay: frame time %.3fx calibration, baseline %.3fx (%+.1f%%)\n", current, relative, change);
+	return true;
+}
@@ -0,0 +1,78 @@
+// Vertex Skinning
+// Recorded input sessions, replay frame timings and the regression check against a baseline.
+
+#ifndef SESSION_H
+#define SESSION_H
+
+class Vertex;
+
+#define INPUT_KEY     0 // keyboard()
+#define INPUT_SPECIAL 1 // specialKeyboard()
+
+#define CHECKSUM_SUMS 8
+
+class InputEvent {
+public:
+	unsigned int frame; // frames displayed before the key press
+	unsigned char type;
+	unsigned char key;
+};
+
+class InputSession {
+public:
+	int count;
+	int capacity;
+	InputEvent* events;  // in the order they happened
+	unsigned int frames; // length of the session in frames
+};
+
+InputSession* createInputSession();
+void freeInputSession(InputSession* session);
+void recordInputEvent(InputSession* session, unsigned int frame, int type, int key);
+
+// 16 byte header, then 6 bytes per event
+bool saveInputSession(const char* path, const InputSession* session);
+InputSession* loadInputSession(const char* path);
+
+// Per-frame timings of a replay and a checksum of everything it skinned. Every frame also times
+// a fixed calibration workload, so the gate can compare the frame time relative to the
+// machine's speed at that moment instead of raw milliseconds.
+//
+// The checksum is CHECKSUM_SUMS sums of every skinned coordinate with a pseudo-random sign per
+// sum. A coordinate that moves by d moves each sum by d, while the last-bit differences between
+// compilers and flags stay a random walk far below that, so two replays are compared with a
+// tolerance instead of bit for bit.
+class FrameTimes {
+public:
+	int count;
+	int capacity;
+	double* times;        // seconds
+	double* calibration;  // seconds, one per frame
+	double checksum[CHECKSUM_SUMS];
+	unsigned int checksumState; // picks the signs of the next coordinate
+};
+
+FrameTimes* createFrameTimes(int capacity);
+void freeFrameTimes(FrameTimes* frameTimes);
+void addFrameTime(FrameTimes* frameTimes, double seconds, double calibrationSeconds);
+
+void addChecksumVertices(FrameTimes* frameTimes, const Vertex* vertices, int count);
+
+// Runs the calibration workload once and returns how long it took
+double timeCalibration();
+
+void printFrameTimes(const FrameTimes* frameTimes);
+bool saveFrameTimes(const char* path, const FrameTimes* frameTimes);
+
+// The checksum file holds the frame count and the sums, committed next to the session it was
+// replayed from. checkReplayChecksum fails when any sum is off by more than CHECKSUM_TOLERANCE.
+bool writeReplayChecksum(const char* path, const FrameTimes* frameTimes);
+bool checkReplayChecksum(const char* path, const FrameTimes* frameTimes);
+
+// The timing baseline holds the median frame time over the median calibration time. The ratio
+// cancels most of the machine's load; checkReplayBaseline fails when it grew by more than
+// thresholdPercent. The baseline is committed with the session; a missing one fails the check.
+bool writeReplayBaseline(const char* path, const FrameTimes* frameTimes);
+bool checkReplayBaseline(const char* path, const FrameTimes* frameTimes, float thresholdPercent);
+
+#endif
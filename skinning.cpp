@@ -0,0 +1,173 @@
+// Vertex Skinning
+// Mesh vertex type, matrix helpers and the CPU skinning kernels.
+
+#include "skinning.h"
+#include "morph.h"
+#include <stdlib.h>
+
+float* multMatrixByConstant(const float* aMatrix, float constant) {
+	float* resultMatrix = (float *) malloc(16 * sizeof(float));
+
+	for(int i = 0; i < 16; i++) {
+		resultMatrix[i] = 0.0f;
+	}
+
+	for(int i = 0; i < 16; i++) {
+		resultMatrix[i] = aMatrix[i] * constant;
+	}
+	return resultMatrix;
+}
+
+float* multVectorByConstant(const float* aVector, float constant) {
+	float* resultVector = (float *) malloc(4 * sizeof(float));
+
+	for(int i = 0; i < 4; i++) {
+		resultVector[i] = aVector[i] * constant;
+	}
+	return resultVector;
+}
+
+float* addVectors(const float* aVector, const float *bVector) {
+	float* resultVector = (float *) malloc(4 * sizeof(float));
+
+	for(int i = 0; i < 4; i++) {
+		resultVector[i] = aVector[i] * bVector[i];
+	}
+	return resultVector;
+}
+
+float* addMatrix(const float* aMatrix, const float* bMatrix) {
+	float* resultMatrix = (float *) malloc(16 * sizeof(float));
+
+	for(int i = 0; i < 16; i++) {
+		resultMatrix[i] = 0.0f;
+	}
+
+	for(int i = 0; i < 16; i++) {
+		resultMatrix[i] = aMatrix[i] + bMatrix[i];
+	}
+	return resultMatrix;
+}
+
+float* multMatrixByMatrix(const float* aMatrix, const float* bMatrix){
+	float* resultMatrix = (float *) malloc(16 * sizeof(float));
+	double sum;
+
+	for(int i = 0; i < 16; i++) {
+		resultMatrix[i] = 0.0f;
+	}
+
+	for(int i = 0; i < 4; i++) {
+		for(int j = 0; j < 4; j++) {
+			sum = 0.0f;
+			for(int k = 0; k < 4; k++) {
+				sum += aMatrix[i + k*4] * bMatrix[j*4 + k];
+			}
+			resultMatrix[i + j*4] = sum;
+		}
+	}
+	return resultMatrix;
+}
+
+//COLUMN MAJOR
+float* multMatrixByVector(const float A[16], const float b[4]) {
+	float* resultVector = (float *) malloc(4 * sizeof(float));
+	resultVector[0] = A[0] * b[0] + A[4] * b[1] + A[8] * b[2] + A[12] * b[3];
+	resultVector[1] = A[1] * b[0] + A[5] * b[1] + A[9] * b[2] + A[13] * b[3];
+	resultVector[2] = A[2] * b[0] + A[6] * b[1] + A[10] * b[2] + A[14] * b[3];
+	resultVector[3] = A[3] * b[0] + A[7] * b[1] + A[11] * b[2] + A[15] * b[3];
+	return resultVector;
+}
+
+void skinVerticesHelpers(const Vertex* original, Vertex* weighted, int count,
+						 const float* matrix1, const float* matrix2, const float base[3])
+{
+	for(int v = 0; v < count; v++) {
+		float* upperMatrix = multMatrixByConstant(matrix1, original[v].weight1); // w1M1
+		float* lowerMatrix = multMatrixByConstant(matrix2, original[v].weight2); // w2M2
+		float* weightedMatrix = addMatrix(upperMatrix, lowerMatrix); // w1M1 + w2M2
+
+		float origin[4] = { original[v].x - base[0], original[v].y - base[1], original[v].z - base[2], 1};
+
+		float* finalPosition = multMatrixByVector(weightedMatrix, origin); // (w1M1 + w2M2) * V
+		weighted[v] = Vertex(finalPosition[0], finalPosition[1], finalPosition[2],
+							 original[v].boneID1, original[v].boneID2, original[v].weight1, original[v].weight2);
+
+		free(upperMatrix);
+		free(lowerMatrix);
+		free(weightedMatrix);
+		free(finalPosition);
+	}
+}
+
+void skinVertices(const Vertex* original, Vertex* weighted, int count,
+				  const float* matrix1, const float* matrix2, const float base[3],
+				  MorphTarget** active, int activeCount,
+				  const float* normals, float* weightedNormals)
+{
+	// one cursor per active target into its sorted index list, plus the
+	// smallest index any of them is waiting for so untouched vertices skip the targets entirely
+	int cursor[MAX_MORPH_TARGETS];
+	int nextMorphed = count;
+	for(int t = 0; t < activeCount; t++) {
+		cursor[t] = 0;
+		if(active[t]->indices[0] < nextMorphed) {
+			nextMorphed = active[t]->indices[0];
+		}
+	}
+
+	for(int v = 0; v < count; v++) {
+		float x = original[v].x;
+		float y = original[v].y;
+		float z = original[v].z;
+		float nx = 0.0f, ny = 0.0f, nz = 0.0f;
+		if(normals != NULL) {
+			nx = normals[v * 3];
+			ny = normals[v * 3 + 1];
+			nz = normals[v * 3 + 2];
+		}
+
+		if(v == nextMorphed) {
+			nextMorphed = count;
+			for(int t = 0; t < activeCount; t++) {
+				MorphTarget* target = active[t];
+				int c = cursor[t];
+				if(c < target->count && target->indices[c] == v) {
+					x += target->weight * target->dx[c];
+					y += target->weight * target->dy[c];
+					z += target->weight * target->dz[c];
+					if(normals != NULL && target->dnx != NULL) {
+						nx += target->weight * target->dnx[c];
+						ny += target->weight * target->dny[c];
+						nz += target->weight * target->dnz[c];
+					}
+					c = ++cursor[t];
+				}
+				if(c < target->count && target->indices[c] < nextMorphed) {
+					nextMorphed = target->indices[c];
+				}
+			}
+		}
+
+		float w1 = original[v].weight1;
+		float w2 = original[v].weight2;
+		float m[16];
+		for(int i = 0; i < 16; i++) {
+			m[i] = matrix1[i] * w1 + matrix2[i] * w2; // w1M1 + w2M2
+		}
+
+		float ox = x - base[0];
+		float oy = y - base[1];
+		float oz = z - base[2];
+		weighted[v] = Vertex(m[0] * ox + m[4] * oy + m[8] * oz + m[12],
+							 m[1] * ox + m[5] * oy + m[9] * oz + m[13],
+							 m[2] * ox + m[6] * oy + m[10] * oz + m[14],
+							 original[v].boneID1, original[v].boneID2, w1, w2);
+
+		if(weightedNormals != NULL) {
+			weightedNormals[v * 3]     = m[0] * nx + m[4] * ny + m[8] * nz;
+			weightedNormals[v * 3 + 1] = m[1] * nx + m[5] * ny + m[9] * nz;
+			weightedNormals[v * 3 + 2] = m[2] * nx + m[6] * ny + m[10] * nz;
+		}
+	}
+}
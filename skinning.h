@@ -0,0 +1,90 @@
+// Vertex Skinning
+// Mesh vertex type, matrix helpers and the CPU skinning kernels.
+// Nothing in here touches OpenGL so the kernels can be run headless.
+
+#ifndef SKINNING_H
+#define SKINNING_H
+
+class MorphTarget;
+
+class Vertex {
+public:
+	float x, y, z, w; // w is ALWAYS 1
+	float coordinates[4];
+	int boneID1, boneID2; // the two bones this vertex is influenced by
+	float weight1, weight2; // the corresponding weight for bone1 and bone2 respectively
+
+	Vertex() {
+		x = 0.0f;
+		y = 0.0f;
+		z = 0.0f;
+		w = 1.0f;
+
+		coordinates[0] = z;
+		coordinates[1] = x;
+		coordinates[2] = y;
+		coordinates[3] = w;
+
+		boneID1 = 0;
+		boneID2 = 0;
+		weight1 = 1;
+		weight2 = 1;
+	}
+
+	Vertex(float x, float y, float z) {
+		this->x = x;
+		this->y = y;
+		this->z = z;
+		this->w = 1.0;
+
+		coordinates[0] = this->x;
+		coordinates[1] = this->y;
+		coordinates[2] = this->z;
+		coordinates[3] = this->w;
+	}
+
+	Vertex(float x, float y, float z, int boneID1, int boneID2, float weight1, float weight2) {
+		this->x = x;
+		this->y = y;
+		this->z = z;
+		this->w = 1.0;
+		this->boneID1 = boneID1;
+		this->boneID2 = boneID2;
+		this->weight1 = weight1;
+		this->weight2 = weight2;
+
+		coordinates[0] = this->x;
+		coordinates[1] = this->y;
+		coordinates[2] = this->z;
+		coordinates[3] = this->w;
+	}
+
+
+	float* getVertex() {
+		return coordinates;
+	}
+};
+
+// All helpers return a malloc'd result that the caller has to free
+float* multMatrixByConstant(const float* aMatrix, float constant);
+float* multVectorByConstant(const float* aVector, float constant);
+float* addVectors(const float* aVector, const float *bVector);
+float* addMatrix(const float* aMatrix, const float* bMatrix);
+float* multMatrixByMatrix(const float* aMatrix, const float* bMatrix);
+float* multMatrixByVector(const float A[16], const float b[4]);
+
+// (w1M1 + w2M2) * (V - base) for every vertex, built out of the helpers above.
+// Kept as the reference for the faster kernel below.
+void skinVerticesHelpers(const Vertex* original, Vertex* weighted, int count,
+						 const float* matrix1, const float* matrix2, const float base[3]);
+
+// Same result as skinVerticesHelpers but without any allocation. The active
+// morph targets are applied to the rest position on the way through, so the
+// blend shapes cost no extra pass over the mesh. Their indices must be sorted.
+// normals/weightedNormals are 3 floats per vertex and may be NULL.
+void skinVertices(const Vertex* original, Vertex* weighted, int count,
+				  const float* matrix1, const float* matrix2, const float base[3],
+				  MorphTarget** active, int activeCount,
+				  const float* normals, float* weightedNormals);
+
+#endif
@@ -0,0 +1,16 @@
+// Vertex Skinning
+// Monotonic wall clock used for the frame statistics and benchmarks.
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <time.h>
+
+inline double nowSeconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#endif
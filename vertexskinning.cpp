@@ -9,12 +9,27 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "skinning.h"
+#include "morph.h"
+#include "timer.h"
+#include "autoweights.h"
+#include "pose.h"
+#include "blend.h"
+#include "debugdraw.h"
+#include "session.h"
 
-#define OGL_AXIS_DLIST	1
 #define OGL_FLOORMESH_DLIST 2
 #define UPPER_ARM_ID 4
 #define LOWER_ARM_ID 5
 
+#define MAX_BONES 64
+#define CROWD_SIZE 256
+#define CROWD_ROW 16
+
+#define AUTO_WEIGHTS_CACHE "vertexskinning.weights"
+#define HEADLESS_REPEATS 5 // runs of every frame in a headless replay, the fastest is timed
+
 #define MESH_HEIGHT 10;
 #define STRIP_LENGTH 10;
 
@@ -52,141 +67,51 @@ typedef struct tBone
 	struct tBone *child;
 } Bone;
 
-class Vertex {
-public:
-	float x, y, z, w; // w is ALWAYS 1
-	float coordinates[4];
-	int boneID1, boneID2; // the two bones this vertex is influenced by
-	float weight1, weight2; // the corresponding weight for bone1 and bone2 respectively
-
-	Vertex() {
-		x = 0.0f;
-		y = 0.0f;
-		z = 0.0f;
-		w = 1.0f;
-		
-		coordinates[0] = z;
-		coordinates[1] = x;
-		coordinates[2] = y;
-		coordinates[3] = w;
-		
-		boneID1 = 0;
-		boneID2 = 0;
-		weight1 = 1;
-		weight2 = 1;
-	}
-
-	Vertex(float x, float y, float z) {
-		this->x = x;
-		this->y = y;
-		this->z = z;
-		this->w = 1.0;
-		
-		coordinates[0] = this->x;
-		coordinates[1] = this->y;
-		coordinates[2] = this->z;
-		coordinates[3] = this->w;
-	}
-
-	Vertex(float x, float y, float z, int boneID1, int boneID2, float weight1, float weight2) {
-		this->x = x;
-		this->y = y;
-		this->z = z;
-		this->w = 1.0;
-		this->boneID1 = boneID1;
-		this->boneID2 = boneID2;
-		this->weight1 = weight1;
-		this->weight2 = weight2;
-		
-		coordinates[0] = this->x;
-		coordinates[1] = this->y;
-		coordinates[2] = this->z;
-		coordinates[3] = this->w;
-	}
-
-	
-	float* getVertex() {
-		return coordinates;
-	}
-};
-
-float* multMatrixByConstant(const float* aMatrix, float constant) {
-	float* resultMatrix = (float *) malloc(16 * sizeof(float));
-
-	for(int i = 0; i < 16; i++) {
-		resultMatrix[i] = 0.0f;
-	}
-
-	for(int i = 0; i < 16; i++) {
-		resultMatrix[i] = aMatrix[i] * constant;
-	}
-	return resultMatrix;
-}
-
-float* multVectorByConstant(const float* aVector, float constant) {
-	float* resultVector = (float *) malloc(4 * sizeof(float));
-
-	for(int i = 0; i < 4; i++) {
-		resultVector[i] = aVector[i] * constant;
-	}
-	return resultVector;
-}
-
-float* addVectors(const float* aVector, const float *bVector) {
-	float* resultVector = (float *) malloc(4 * sizeof(float));
-
-	for(int i = 0; i < 4; i++) {
-		resultVector[i] = aVector[i] * bVector[i];
-	}
-	return resultVector;
-}
-
-float* addMatrix(const float* aMatrix, const float* bMatrix) {
-	float* resultMatrix = (float *) malloc(16 * sizeof(float));
-	
-	for(int i = 0; i < 16; i++) {
-		resultMatrix[i] = 0.0f;
-	}
-
-	for(int i = 0; i < 16; i++) {
-		resultMatrix[i] = aMatrix[i] + bMatrix[i];
-	}
-	return resultMatrix;
-}
-
-float* multMatrixByMatrix(const float* aMatrix, const float* bMatrix){
-	float* resultMatrix = (float *) malloc(16 * sizeof(float));
-	double sum;
-
-	for(int i = 0; i < 16; i++) {
-		resultMatrix[i] = 0.0f;
-	}
-
-	for(int i = 0; i < 4; i++) {
-		for(int j = 0; j < 4; j++) {
-			sum = 0.0f;
-			for(int k = 0; k < 4; k++) {
-				sum += aMatrix[i + k*4] * bMatrix[j*4 + k];
-			}
-			resultMatrix[i + j*4] = sum;
-		}
-	}
-	return resultMatrix;
-}
-
-//COLUMN MAJOR
-float* multMatrixByVector(const float A[16], const float b[4]) {
-	float* resultVector = (float *) malloc(4 * sizeof(float));
-	resultVector[0] = A[0] * b[0] + A[4] * b[1] + A[8] * b[2] + A[12] * b[3];
-	resultVector[1] = A[1] * b[0] + A[5] * b[1] + A[9] * b[2] + A[13] * b[3];
-	resultVector[2] = A[2] * b[0] + A[6] * b[1] + A[10] * b[2] + A[14] * b[3];
-	resultVector[3] = A[3] * b[0] + A[7] * b[1] + A[11] * b[2] + A[15] * b[3];
-	return resultVector;
-}
-
 Bone *upperArm;
 Bone *lowerArm;
 
+// the bones in evaluation order and their local pose
+Bone* skeletonBones[MAX_BONES];
+int skeletonBoneCount = 0;
+PoseBuffer* skeletonPose = NULL;
+float poseEulerX[MAX_BONES], poseEulerY[MAX_BONES], poseEulerZ[MAX_BONES];
+float skeletonMatrices[MAX_BONES * 16];
+const PoseBuffer* currentPose = NULL;
+int skeletonParents[MAX_BONES];
+float boneLengths[MAX_BONES];
+float worldMatrices[MAX_BONES * 16];
+
+// skeleton gizmos for this rig and an optional crowd of copies
+DebugLines* skeletonLines = NULL;
+bool showCrowd = false;
+float crowdMatrices[MAX_BONES * 16];
+double skeletonLineTime = 0.0;
+
+// pose sources and the tree that layers them
+bool blendingEnabled = false;
+BlendTree* blendTree = NULL;
+PoseBuffer *idlePose, *reachPose, *keyboardPose;
+float reachMask[MAX_BONES];
+float reachWeight = 0.0f;
+int reachNode = -1;
+
+// z rotation of the lowerArm in the evaluated pose (degrees), blend layers included; drives the corrective shapes
+float elbowAngle = 0.0f;
+int frameNumber = 0;
+
+// input recording and replay; a replay drives the same keys on the same frames
+InputSession* recording = NULL;
+const char* recordPath = NULL;
+InputSession* replaySession = NULL;
+int replayEvent = 0;
+bool headless = false;
+FrameTimes* frameTimes = NULL;
+const char* checksumPath = NULL;
+const char* baselinePath = NULL;
+bool writeBaseline = false;
+float regressionThreshold = 15.0f; // percent; the calibrated frame time varies about 12% between runs
+const char* frameTimesPath = NULL;
+
 float cameraAngle = 0.0f;
 float cameraRadius = 80.0f;
 float xeye = 0, yeye = 0, zeye = cameraRadius;
@@ -197,6 +122,20 @@ char *weightCaseStr = "Weighting Case 1";
 Vertex originalMesh [22][37];
 Vertex weightedMesh [22][37];
 
+SkinWeights* autoWeights = NULL;
+
+// corrective blend shapes, applied inside the skinning pass
+MorphTarget* morphTargets[MAX_MORPH_TARGETS];
+int morphTargetCount = 0;
+bool morphsEnabled = true;
+
+// skinning pass timings, split by frames with and without active blend shapes
+bool showStats = false;
+int statFrames = 0;
+int baseFrames = 0, morphFrames = 0;
+double baseTime = 0.0, morphTime = 0.0;
+int morphActiveSum = 0, morphVertexSum = 0;
+
 void normal(double x1, double y1, double z1, 
 			double x2, double y2, double z2, 
 			double x3, double y3, double z3) 
@@ -235,158 +174,159 @@ void renderText(GLfloat x, GLfloat y, char* s, GLint red, GLint green, GLint blu
      glMatrixMode(GL_MODELVIEW);
 }
 
-void createBoneAxisDList() 
+void printBoneMatrix(Bone* bone) 
 {
-		glNewList(OGL_AXIS_DLIST,GL_COMPILE);
-		glBegin(GL_LINES);
-			glColor3f(1.0f, 0.0f, 0.0f);	// X AXIS STARTS - COLOR RED
-			glVertex3f(-1.0f,  0.0f, 0.0f);
-			glVertex3f( 1.0f,  0.0f, 0.0f);
-			glVertex3f( 1.0f,  0.0f, 0.0f);	// TOP PIECE OF ARROWHEAD
-			glVertex3f( 0.9f,  0.1f, 0.0f);
-			glVertex3f( 1.0f,  0.0f, 0.0f);	// BOTTOM PIECE OF ARROWHEAD
-			glVertex3f( 0.9f, -0.1f, 0.0f);
-
-			glColor3f(0.0f, 1.0f, 0.0f);	// Y AXIS STARTS - COLOR GREEN
-			glVertex3f( 0.0f,  1.0f, 0.0f);
-			glVertex3f( 0.0f, -1.0f, 0.0f);			
-			glVertex3f( 0.0f,  1.0f, 0.0f);	// TOP PIECE OF ARROWHEAD
-			glVertex3f( 0.1f,  0.9f, 0.0f);
-			glVertex3f( 0.0f,  1.0f, 0.0f);	// BOTTOM PIECE OF ARROWHEAD
-			glVertex3f( -0.1f,  0.9f, 0.0f);
-
-			glColor3ub(51, 51, 255); 	    // Z AXIS STARTS - COLOR BLUE
-			glVertex3f( 0.0f,  0.0f,  1.0f);
-			glVertex3f( 0.0f,  0.0f, -1.0f);
-			glVertex3f( 0.0f,  0.0f, 1.0f);	// TOP PIECE OF ARROWHEAD
-			glVertex3f( 0.0f,  0.1f, 0.9f);
-			glVertex3f( 0.0f, 0.0f, 1.0f);	// BOTTOM PIECE OF ARROWHEAD
-			glVertex3f( 0.0f, -0.1f, 0.9f);
-		glEnd();
-	glEndList();
+	printf("boneID: %d\n", bone->id);
+	printf("BoneMatrix:\n");
+	for(int i = 0; i < 16; i++) {
+		printf("%f ", bone->matrix[i]);
+	}
+	printf("\n");
 }
 
-void createBoneDLists(Bone *bone) {	
-	if(bone->childCount > 0)
-	{
-		glNewList(bone->id, GL_COMPILE);
-			glBegin(GL_LINE_STRIP);
-				glVertex3f( 0.0f, 0.4f, 0.0f); // 0
-				glVertex3f(-0.4f, 0.0f,-0.4f); // 1
-				glVertex3f( 0.4f, 0.0f,-0.4f); // 2
-				glVertex3f( 0.0f, bone->child->trans.y, 0.0f); // Base
-
-				glVertex3f(-0.4f, 0.0f,-0.4f); // 1
-				glVertex3f(-0.4f, 0.0f, 0.4f); // 4
-				glVertex3f( 0.0f, 0.4f, 0.0f); // 0
-
-				glVertex3f( 0.4f, 0.0f,-0.4f); // 2
-				glVertex3f( 0.4f, 0.0f, 0.4f); // 3
-
-				glVertex3f( 0.0f, 0.4f, 0.0f); // 0
-				glVertex3f(-0.4f, 0.0f, 0.4f); // 4
-				glVertex3f( 0.0f, bone->child->trans.y, 0.0f); // Base
-				glVertex3f( 0.4f, 0.0f, 0.4f); // 3
-				glVertex3f(-0.4f, 0.0f, 0.4f); // 4
-			glEnd();
-		glEndList();
-
-		if(bone->childCount > 0) {
-			createBoneDLists(bone->child);
+// Gizmos for the rig, and the crowd copies of it when enabled, go into one
+// line buffer from the evaluated world matrices and are drawn with one call
+void drawSkeletonLines()
+{
+	double start = nowSeconds();
+	clearDebugLines(skeletonLines);
+	appendSkeletonLines(skeletonLines, worldMatrices, boneLengths, skeletonBoneCount);
+	if(showCrowd) {
+		for(int n = 0; n < CROWD_SIZE; n++) {
+			// rigs on a grid behind the arm
+			float offsetX = (n % CROWD_ROW - CROWD_ROW / 2) * 4.0f;
+			float offsetZ = -10.0f - (n / CROWD_ROW) * 4.0f;
+			for(int i = 0; i < skeletonBoneCount * 16; i++) {
+				crowdMatrices[i] = worldMatrices[i];
+			}
+			for(int b = 0; b < skeletonBoneCount; b++) {
+				crowdMatrices[b * 16 + 12] += offsetX;
+				crowdMatrices[b * 16 + 14] += offsetZ;
+			}
+			appendSkeletonLines(skeletonLines, crowdMatrices, boneLengths, skeletonBoneCount);
 		}
 	}
+	skeletonLineTime += nowSeconds() - start;
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, skeletonLines->positions);
+	glColorPointer(4, GL_UNSIGNED_BYTE, 0, skeletonLines->colors);
+	glDrawArrays(GL_LINES, 0, skeletonLines->count);
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
 }
 
-void printBoneMatrix(Bone* bone) 
+// Lists the bones that have a child, root first, and sets up the pose buffers for them
+void initializeSkeletonPose(Bone* rootBone)
 {
-	printf("boneID: %d\n", bone->id);
-	printf("BoneMatrix:\n");
-	for(int i = 0; i < 16; i++) {
-		printf("%f ", bone->matrix[i]);
+	skeletonBoneCount = 0;
+	for(Bone* bone = rootBone; bone != NULL && bone->childCount > 0 && skeletonBoneCount < MAX_BONES; bone = bone->child) {
+		skeletonParents[skeletonBoneCount] = skeletonBoneCount - 1;
+		boneLengths[skeletonBoneCount] = bone->child->trans.y;
+		skeletonBones[skeletonBoneCount++] = bone;
 	}
-	printf("\n");
+	skeletonPose = createPoseBuffer(skeletonBoneCount);
+	currentPose = skeletonPose;
+	skeletonLines = createDebugLines((CROWD_SIZE + 1) * skeletonBoneCount * DEBUG_LINES_PER_BONE);
 }
 
-void drawSkeleton(Bone *rootBone) 
+// Idle loop and reach pose layered under the keyboard rotations. The upperArm
+// is bone 0 and the lowerArm bone 1; the reach only takes half of the upperArm.
+void initializeBlendTree()
 {
-	int loop;
-	Bone *currentBone;
-
-	currentBone = rootBone;
-	for(loop = 0; loop < rootBone->childCount; loop++) {
-		glPushMatrix();
-
-			// Set base orientation and position
-			glTranslatef(currentBone->trans.x, currentBone->trans.y, currentBone->trans.z);
-
-			glRotatef(currentBone->rot.z, 0.0f, 0.0f, 1.0f);
-			glRotatef(currentBone->rot.y, 0.0f, 1.0f, 0.0f);
-			glRotatef(currentBone->rot.x, 1.0f, 0.0f, 0.0f);
-
-			// The scale is local so push and pop
-			glPushMatrix();
-				glScalef(currentBone->scale.x, currentBone->scale.y, currentBone->scale.z);
-				
-				// draw the openGL axis object
-				glCallList(OGL_AXIS_DLIST);
-
-				// draw the actual bone structure, only make a bone if there is a child
-				if(currentBone->childCount > 0) {
-					glColor3ub(224, 224, 0);
-					glCallList(currentBone->id);
-				}
+	idlePose = createPoseBuffer(skeletonBoneCount);
+	reachPose = createPoseBuffer(skeletonBoneCount);
+	keyboardPose = createPoseBuffer(skeletonBoneCount);
+
+	float reachX[2] = {0.0f, 0.0f};
+	float reachY[2] = {0.0f, 30.0f};
+	float reachZ[2] = {25.0f, 75.0f};
+	for(int i = 0; i < skeletonBoneCount; i++) {
+		Bone* bone = skeletonBones[i];
+		idlePose->tx[i] = reachPose->tx[i] = bone->trans.x;
+		idlePose->ty[i] = reachPose->ty[i] = bone->trans.y;
+		idlePose->tz[i] = reachPose->tz[i] = bone->trans.z;
+		idlePose->sx[i] = reachPose->sx[i] = bone->scale.x;
+		idlePose->sy[i] = reachPose->sy[i] = bone->scale.y;
+		idlePose->sz[i] = reachPose->sz[i] = bone->scale.z;
+		reachMask[i] = i == 0 ? 0.5f : 1.0f;
+	}
+	eulerToQuaternions(reachX, reachY, reachZ, reachPose->qx, reachPose->qy, reachPose->qz, reachPose->qw, 2);
+
+	blendTree = createBlendTree(skeletonBoneCount);
+	int idle = addSourceNode(blendTree, "idle", idlePose);
+	int reach = addSourceNode(blendTree, "reach", reachPose);
+	int keys = addSourceNode(blendTree, "keyboard", keyboardPose);
+	reachNode = addLerpNode(blendTree, "idle/reach", idle, reach, reachWeight, reachMask);
+	addAdditiveNode(blendTree, "+keyboard", reachNode, keys, 1.0f, NULL);
+}
 
-				// grab the matrix at this point so that we can use it for the deformation
-				//glGetFloatv(GL_MODELVIEW_MATRIX, currentBone->matrix);
-				float scaleMatrix[16] = {currentBone->scale.x, 0, 0, 0, 
-									  0, currentBone->scale.y, 0, 0,
-									  0, 0, currentBone->scale.z, 0,
-									  0, 0, 0, 1};
-
-				float transMatrix[16] = {1, 0, 0, 0, 
-									  0, 1, 0, 0,
-									  0, 0, 1, 0,
-									  currentBone->trans.x, currentBone->trans.y, currentBone->trans.z, 1};
-
-				float rotXMatrix[16] = {1, 0, 0, 0,
-										0, cos(currentBone->rot.x * M_PI /180), sin(currentBone->rot.x * M_PI / 180), 0,
-										0, -sin(currentBone->rot.x * M_PI / 180), cos(currentBone->rot.x * M_PI /180), 0,
-										0, 0, 0, 1};
-				float rotYMatrix[16] = {cos(currentBone->rot.y * M_PI /180), 0, -sin(currentBone->rot.y * M_PI / 180), 0,
-										0, 1, 0, 0,
-										sin(currentBone->rot.y * M_PI / 180), 0, cos(currentBone->rot.y * M_PI /180), 0,
-										0, 0, 0, 1};
-				float rotZMatrix[16] = {cos(currentBone->rot.z * M_PI /180), sin(currentBone->rot.z * M_PI / 180), 0, 0,
-										-sin(currentBone->rot.z * M_PI / 180), cos(currentBone->rot.z * M_PI /180), 0, 0,
-										0, 0, 1, 0,
-										0, 0, 0, 1};
-
-				float identity[16] = {1, 0, 0, 0,
-									  0, 1, 0, 0,
-									  0, 0, 1, 0,
-									  0, 0, 0, 1};
-
-				float* afterScaling = multMatrixByMatrix(scaleMatrix, identity);
-				float* afterRotX = multMatrixByMatrix(rotXMatrix, afterScaling);
-				float* afterRotY = multMatrixByMatrix(rotYMatrix, afterRotX);
-				float* afterRotZ = multMatrixByMatrix(rotZMatrix, afterRotY);
-
-				free(afterScaling);
-				free(afterRotX);
-				free(afterRotY);
-
-				for(int i = 0; i < 16; i++) {
-					currentBone->matrix[i] = afterRotZ[i];
-				}
-				free(afterRotZ);
+// The idle loop sways the elbow, timed by frames so it plays back the same way every run
+void updateIdlePose()
+{
+	float phase = frameNumber * 2.0f * M_PI / 120.0f;
+	for(int i = 0; i < skeletonBoneCount; i++) {
+		poseEulerX[i] = 0.0f;
+		poseEulerY[i] = 0.0f;
+		poseEulerZ[i] = (i == 0 ? 4.0f : 15.0f) * sin(phase);
+	}
+	eulerToQuaternions(poseEulerX, poseEulerY, poseEulerZ,
+					   idlePose->qx, idlePose->qy, idlePose->qz, idlePose->qw, skeletonBoneCount);
+}
 
-			glPopMatrix();
+// Converts every bone's translation/rotation/scale to its matrix in one batch
+void evaluatePose()
+{
+	for(int i = 0; i < skeletonBoneCount; i++) {
+		Bone* bone = skeletonBones[i];
+		poseEulerX[i] = bone->rot.x;
+		poseEulerY[i] = bone->rot.y;
+		poseEulerZ[i] = bone->rot.z;
+		skeletonPose->tx[i] = bone->trans.x;
+		skeletonPose->ty[i] = bone->trans.y;
+		skeletonPose->tz[i] = bone->trans.z;
+		skeletonPose->sx[i] = bone->scale.x;
+		skeletonPose->sy[i] = bone->scale.y;
+		skeletonPose->sz[i] = bone->scale.z;
+	}
+	eulerToQuaternions(poseEulerX, poseEulerY, poseEulerZ,
+					   skeletonPose->qx, skeletonPose->qy, skeletonPose->qz, skeletonPose->qw, skeletonBoneCount);
+
+	currentPose = skeletonPose;
+	if(blendingEnabled) {
+		// the keyboard rotations become an additive layer on top of idle/reach
+		for(int i = 0; i < skeletonBoneCount; i++) {
+			keyboardPose->qx[i] = skeletonPose->qx[i];
+			keyboardPose->qy[i] = skeletonPose->qy[i];
+			keyboardPose->qz[i] = skeletonPose->qz[i];
+			keyboardPose->qw[i] = skeletonPose->qw[i];
+		}
+		updateIdlePose();
+		blendTree->nodes[reachNode].weight = reachWeight;
+		currentPose = evaluateBlendTree(blendTree);
+	}
+	poseToMatrices(currentPose, skeletonMatrices);
+
+	// with blending the elbow bend is the tilt of the bone's own axis (the matrix's second
+	// column) in the xy plane, which twisting the bone about that axis leaves alone
+	elbowAngle = lowerArm->rot.z;
+	for(int i = 0; blendingEnabled && i < skeletonBoneCount; i++) {
+		if(skeletonBones[i] == lowerArm) {
+			float x = currentPose->qx[i], y = currentPose->qy[i], z = currentPose->qz[i], w = currentPose->qw[i];
+			elbowAngle = atan2(-2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z)) * 180.0f / M_PI;
+		}
+	}
+	localToWorldMatrices(currentPose, skeletonParents, worldMatrices);
 
-			// check if this bone has children, do recursive call if true
-			if(currentBone->childCount > 0) {
-				drawSkeleton(currentBone->child);
-			}
-		glPopMatrix();
+	// the deformation works around the bone base, so it only takes the rotation and scale
+	for(int i = 0; i < skeletonBoneCount; i++) {
+		for(int j = 0; j < 16; j++) {
+			skeletonBones[i]->matrix[j] = skeletonMatrices[i * 16 + j];
+		}
+		skeletonBones[i]->matrix[12] = 0.0f;
+		skeletonBones[i]->matrix[13] = 0.0f;
+		skeletonBones[i]->matrix[14] = 0.0f;
 	}
 }
 
@@ -572,6 +512,28 @@ void weightCase5() {
 	setWeights(20, 1.00f);
 }
 
+// weights generated from the bone segments instead of a table, see initializeAutoWeights()
+void weightCase6() {
+	if(autoWeights == NULL) {
+		weightCase1();
+		return;
+	}
+	for(int i = 0; i < 22; i++) {
+		for(int j = 0; j < 37; j++) {
+			const int* bones = autoWeights->bones + (i * 37 + j) * autoWeights->influences;
+			const float* weights = autoWeights->weights + (i * 37 + j) * autoWeights->influences;
+			float upperWeight = 0.0f;
+			for(int k = 0; k < autoWeights->influences; k++) {
+				if(bones[k] == 0) {
+					upperWeight += weights[k];
+				}
+			}
+			originalMesh[i][j].weight1 = upperWeight;
+			originalMesh[i][j].weight2 = 1.0f - upperWeight;
+		}
+	}
+}
+
 void setWeightCase(int number) {
 	switch(number) {
 		case 1: weightCase1(); break;
@@ -579,6 +541,7 @@ void setWeightCase(int number) {
 		case 3: weightCase3(); break;
 		case 4: weightCase4(); break;
 		case 5: weightCase5(); break;
+		case 6: weightCase6(); break;
 		default: weightCase1(); break;
 	}
 }
@@ -587,7 +550,7 @@ void createOriginalMeshMatrix(int height, float radius)
 {
 	float weight1 = 0.0f;
 	float weight2 = 0.0f;
-	for(int i = 0; i <= height * 2; i++) {
+	for(int i = 0; i <= height * 2 && i < 22; i++) {
 		for(int alpha = 0; alpha < 370; alpha += 10) {		
 			Vertex vertex(radius * sin(alpha * M_PI / 180), 0.5 * i, radius * cos(alpha * M_PI / 180), UPPER_ARM_ID, LOWER_ARM_ID, weight1, weight2);
 			originalMesh[i][alpha/10] = vertex;
@@ -596,6 +559,27 @@ void createOriginalMeshMatrix(int height, float radius)
 	setWeightCase(weightCaseNumber);
 }
 
+// Distance based weights for the two arm bones, cached in the working directory
+void initializeAutoWeights()
+{
+	createOriginalMeshMatrix(11, 1.75f);
+
+	float positions[22 * 37 * 3];
+	for(int i = 0; i < 22; i++) {
+		for(int j = 0; j < 37; j++) {
+			positions[(i * 37 + j) * 3] = originalMesh[i][j].x;
+			positions[(i * 37 + j) * 3 + 1] = originalMesh[i][j].y;
+			positions[(i * 37 + j) * 3 + 2] = originalMesh[i][j].z;
+		}
+	}
+
+	// in mesh space the elbow sits at (0, 5, 0); bone 0 is the upperArm above it, bone 1 the lowerArm below
+	float boneStarts[2 * 3] = {0.0f, 5.0f, 0.0f,   0.0f, 5.0f, 0.0f};
+	float boneEnds[2 * 3]   = {0.0f, 10.0f, 0.0f,  0.0f, 0.0f, 0.0f};
+
+	autoWeights = loadOrComputeSkinWeights(AUTO_WEIGHTS_CACHE, positions, 22 * 37, boneStarts, boneEnds, 2, 2, 4.0f);
+}
+
 void drawOriginalArmMesh() {
 	
 	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
@@ -610,24 +594,91 @@ void drawOriginalArmMesh() {
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 }
 
+// Corrective shapes for the elbow: linear blending thins the outer side of the
+// bend, so push the rows around the elbow (row 10) back out, most on that side.
+void createElbowMorphTargets(int height, float radius)
+{
+	const int vertexCount = 22 * 37;
+	float* deltas = (float *) malloc(vertexCount * 3 * sizeof(float));
+	const char* names[2] = {"elbowBendLeft", "elbowBendRight"};
+	float side[2] = {1.0f, -1.0f};
+
+	for(int t = 0; t < 2; t++) {
+		for(int i = 0; i < vertexCount * 3; i++) {
+			deltas[i] = 0.0f;
+		}
+		for(int i = 0; i <= height * 2 && i < 22; i++) {
+			float falloff = 1.0f - fabs(i - 10) / 4.0f;
+			if(falloff <= 0.0f) {
+				continue;
+			}
+			for(int alpha = 0; alpha < 370; alpha += 10) {
+				float sx = sin(alpha * M_PI / 180);
+				float sz = cos(alpha * M_PI / 180);
+				float outer = -side[t] * sx > 0.0f ? -side[t] * sx : 0.0f;
+				float amount = 0.35f * radius * falloff * (0.25f + 0.75f * outer);
+				float* d = deltas + (i * 37 + alpha / 10) * 3;
+				d[0] = sx * amount;
+				d[2] = sz * amount;
+			}
+		}
+		morphTargets[morphTargetCount] = createMorphTarget(names[t], deltas, NULL, vertexCount, 1e-4f);
+		setMorphDriver(morphTargets[morphTargetCount], &elbowAngle, 0.0f, 90.0f * side[t]);
+		morphTargetCount++;
+	}
+	free(deltas);
+}
+
+void printSkinningStats(MorphTarget** active, int activeCount)
+{
+	double base = baseFrames > 0 ? baseTime / baseFrames : 0.0;
+	printf("skinning: %.1f us/frame without blend shapes (%d frames)", base * 1e6, baseFrames);
+	if(morphFrames > 0 && morphActiveSum > 0) {
+		double withMorphs = morphTime / morphFrames;
+		double perTarget = (withMorphs - base) / ((double) morphActiveSum / morphFrames);
+		double perVertex = (withMorphs - base) / ((double) morphVertexSum / morphFrames);
+		printf(", %.1f us/frame with (%d frames), %.2f us per active target, %.1f ns per morphed vertex",
+			   withMorphs * 1e6, morphFrames, perTarget * 1e6, perVertex * 1e9);
+	}
+	printf("\n");
+	for(int t = 0; t < activeCount; t++) {
+		printf("  %s: weight %.2f, %d vertices\n", active[t]->name, active[t]->weight, active[t]->count);
+	}
+}
+
 void createWeightedMeshMatrix() {
+	MorphTarget* active[MAX_MORPH_TARGETS];
+	int activeCount = 0;
+	int morphedVertices = 0;
+	if(morphsEnabled) {
+		activeCount = gatherActiveMorphs(morphTargets, morphTargetCount, active);
+	}
+	for(int t = 0; t < activeCount; t++) {
+		morphedVertices += active[t]->count;
+	}
 
-	for(int i = 0; i < 22; i++) {
-		for(int j = 0; j < 37; j++) {
-			float* upperMatrix = multMatrixByConstant(upperArm->matrix, originalMesh[i][j].weight1); // w1M1
-			float* lowerMatrix = multMatrixByConstant(lowerArm->matrix, originalMesh[i][j].weight2); // w2M2
-			float* weightedMatrix = addMatrix(upperMatrix, lowerMatrix); // w1M1 + w2M2
-			
-			float origin[4] = { originalMesh[i][j].x, originalMesh[i][j].y - 5, originalMesh[i][j].z, 1}; // where the bone base lies (0, 5, 0);
-			
-			float* finalPosition = multMatrixByVector(weightedMatrix, origin); // (w1M1 + w2M2) * V
-			weightedMesh[i][j] = Vertex(finalPosition[0], finalPosition[1], finalPosition[2], UPPER_ARM_ID, LOWER_ARM_ID, originalMesh[i][j].weight1, originalMesh[i][j].weight2);
-			
-			free(upperMatrix);
-			free(lowerMatrix);
-			free(weightedMatrix);
-			free(finalPosition);
+	float base[3] = {0.0f, 5.0f, 0.0f}; // where the bone base lies (0, 5, 0);
+	double start = nowSeconds();
+	skinVertices(&originalMesh[0][0], &weightedMesh[0][0], 22 * 37, upperArm->matrix, lowerArm->matrix, base,
+				 active, activeCount, NULL, NULL);
+	double elapsed = nowSeconds() - start;
+
+	if(activeCount == 0) {
+		baseFrames++;
+		baseTime += elapsed;
+	} else {
+		morphFrames++;
+		morphTime += elapsed;
+		morphActiveSum += activeCount;
+		morphVertexSum += morphedVertices;
+	}
+	if(showStats && ++statFrames % 100 == 0) {
+		printSkinningStats(active, activeCount);
+		if(blendingEnabled) {
+			printBlendStats(blendTree);
 		}
+		printf("skeleton lines: %d vertices in 1 draw call, %.1f us/frame to build\n",
+			   skeletonLines->count, skeletonLineTime / (frameNumber + 1) * 1e6);
 	}
 }
 
@@ -645,8 +696,104 @@ void drawWeightedArmMesh()
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 }
 
+void applyKey(unsigned char key)
+{
+	switch(key) {
+		case 'd': cameraAngle += 10; break;
+		case 'a': cameraAngle -= 10; break;
+		case 'w': cameraRadius -= 1; break;
+		case 's': cameraRadius += 1; break;
+		case 'y': lowerArm->rot.y += 2; break;
+		case 'm': morphsEnabled = !morphsEnabled;
+				  printf("blend shapes %s\n", morphsEnabled ? "on" : "off"); break;
+		case 'p': showStats = !showStats; break;
+		case 'c': showCrowd = !showCrowd; break;
+		case 'b': blendingEnabled = !blendingEnabled;
+				  printf("pose blending %s\n", blendingEnabled ? "on" : "off"); break;
+		case 'r': reachWeight = reachWeight >= 1.0f ? 0.0f : reachWeight + 0.25f;
+				  printf("reach weight %.2f\n", reachWeight); break;
+
+		case '1': weightCaseNumber = 1; 
+				  weightCaseStr = "Weighting Case 1"; break;
+		case '2': weightCaseNumber = 2;
+				  weightCaseStr = "Weighting Case 2"; break;
+		case '3': weightCaseNumber = 3;
+				  weightCaseStr = "Weighting Case 3"; break;
+		case '4': weightCaseNumber = 4;
+				  weightCaseStr = "Weighting Case 4"; break;
+		case '5': weightCaseNumber = 5;
+				  weightCaseStr = "Weighting Case 5"; break;
+		case '6': weightCaseNumber = 6;
+				  weightCaseStr = "Automatic Weights"; break;
+
+		case 27 : exit(EXIT_SUCCESS);
+	}
+}
+
+void applySpecialKey(int key)
+{
+	switch(key) {
+		case GLUT_KEY_UP: yeye += 1; break;
+		case GLUT_KEY_DOWN: yeye -= 1; break;
+		case GLUT_KEY_LEFT: lowerArm->rot.z -= 2; break;
+		case GLUT_KEY_RIGHT: lowerArm->rot.z += 2; break;
+	}
+}
+
+// Applies the key presses stamped with the current frame
+void replayInput()
+{
+	while(replayEvent < replaySession->count
+		  && replaySession->events[replayEvent].frame <= (unsigned int) frameNumber) {
+		const InputEvent* event = &replaySession->events[replayEvent++];
+		if(event->type == INPUT_KEY) {
+			applyKey(event->key);
+		} else {
+			applySpecialKey(event->key);
+		}
+	}
+}
+
+// Everything a frame computes, without drawing: pose, rest mesh and skinning
+void updateFrame()
+{
+	evaluatePose();
+	createOriginalMeshMatrix(11, 1.75f);
+	createWeightedMeshMatrix();
+}
+
+// Reports the replay, writes or checks the checksum and frame time baseline, and exits nonzero on a regression
+void finishReplay()
+{
+	printFrameTimes(frameTimes);
+	bool pass = true;
+	if(frameTimesPath != NULL && !saveFrameTimes(frameTimesPath, frameTimes)) {
+		printf("could not write frame times %s\n", frameTimesPath);
+	}
+	if(checksumPath != NULL) {
+		if(writeBaseline) {
+			bool written = writeReplayChecksum(checksumPath, frameTimes);
+			printf(written ? "wrote replay checksum %s\n" : "could not write replay checksum %s\n", checksumPath);
+			pass = pass && written;
+		} else {
+			pass = checkReplayChecksum(checksumPath, frameTimes) && pass;
+		}
+	}
+	if(baselinePath != NULL) {
+		if(writeBaseline) {
+			bool written = writeReplayBaseline(baselinePath, frameTimes);
+			printf(written ? "wrote frame time baseline %s\n" : "could not write frame time baseline %s\n", baselinePath);
+			pass = pass && written;
+		} else {
+			pass = checkReplayBaseline(baselinePath, frameTimes, regressionThreshold) && pass;
+		}
+	}
+	exit(pass ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
 void display()
 {
+	double start = nowSeconds();
 	float lightPos[4] = {0.0, 10.0, 0.0, 1.0};
 
 	zeye = cameraRadius * cos(cameraAngle / 180.0 * M_PI);
@@ -673,15 +820,18 @@ void display()
 		//glCallList(OGL_FLOORMESH_DLIST);
 	//glPopMatrix();
 	
-	glPushMatrix();
-		drawSkeleton(upperArm);
-	glPopMatrix();
+	if(replaySession != NULL) {
+		replayInput();
+	}
+	updateFrame();
+	if(frameTimes != NULL) {
+		addChecksumVertices(frameTimes, &weightedMesh[0][0], 22 * 37);
+	}
+	drawSkeletonLines();
 	
 	glPushMatrix();
 		glColor3ub(102, 0, 51);
-		createOriginalMeshMatrix(11, 1.75f);
 		//drawOriginalArmMesh();
-		createWeightedMeshMatrix();
 		drawWeightedArmMesh();
 		glColor3ub(255, 255, 255);
 		createArmPointMesh();
@@ -689,6 +839,14 @@ void display()
 	
 	glFlush();
 	glutSwapBuffers();
+	frameNumber++;
+
+	if(replaySession != NULL) {
+		addFrameTime(frameTimes, nowSeconds() - start, timeCalibration());
+		if((unsigned int) frameNumber >= replaySession->frames) {
+			finishReplay();
+		}
+	}
 }
 
 void animate()
@@ -696,41 +854,40 @@ void animate()
 	glutPostRedisplay();
 }
 
+// Escape is never recorded: it ends the session, and the replay ends on its own
 void keyboard(unsigned char key, int x, int y) 
 {
-	switch(key) {
-		case 'd': cameraAngle += 10; break;
-		case 'a': cameraAngle -= 10; break;
-		case 'w': cameraRadius -= 1; break;
-		case 's': cameraRadius += 1; break;
-		case 'y': lowerArm->rot.y += 2; break;
-
-		case '1': weightCaseNumber = 1; 
-				  weightCaseStr = "Weighting Case 1"; break;
-		case '2': weightCaseNumber = 2;
-				  weightCaseStr = "Weighting Case 2"; break;
-		case '3': weightCaseNumber = 3;
-				  weightCaseStr = "Weighting Case 3"; break;
-		case '4': weightCaseNumber = 4;
-				  weightCaseStr = "Weighting Case 4"; break;
-		case '5': weightCaseNumber = 5;
-				  weightCaseStr = "Weighting Case 5"; break;
-
-		case 27 : exit(EXIT_SUCCESS);
+	if(replaySession != NULL && key != 27) {
+		return; // the replay owns the input
 	}
+	if(recording != NULL && key != 27) {
+		recordInputEvent(recording, frameNumber, INPUT_KEY, key);
+	}
+	applyKey(key);
 	glutPostRedisplay();
 }
 
 void specialKeyboard(int key, int x, int y) {
-	switch(key) {
-		case GLUT_KEY_UP: yeye += 1; break;
-		case GLUT_KEY_DOWN: yeye -= 1; break;
-		case GLUT_KEY_LEFT: lowerArm->rot.z -= 2; break;
-		case GLUT_KEY_RIGHT: lowerArm->rot.z += 2; break;
+	if(replaySession != NULL) {
+		return;
+	}
+	if(recording != NULL) {
+		recordInputEvent(recording, frameNumber, INPUT_SPECIAL, key);
 	}
+	applySpecialKey(key);
 	glutPostRedisplay();
 }
 
+void saveRecording()
+{
+	recording->frames = frameNumber;
+	if(saveInputSession(recordPath, recording)) {
+		printf("recorded %d key presses over %d frames to %s\n", recording->count, frameNumber, recordPath);
+	} else {
+		printf("could not write input session %s\n", recordPath);
+	}
+}
+
 void initializeGL()	
 {
 	glShadeModel(GL_SMOOTH);
@@ -747,7 +904,6 @@ void initializeGL()
     glLoadIdentity ();
     glFrustum(-1.0, 1.0, -1.0, 1.0, 10.0, 100.0);
 
-	createBoneAxisDList();
 	createFloorMeshDisplayList();
 }
 
@@ -783,13 +939,101 @@ void initializeSkeleton()
 	lowerArm->child = endBone;
 	lowerArm->childCount = 1;
 
-	endBone->trans.y = -5;
+	endBone->trans.y = -5; // -5 wrt lowerArm's base
+
+	initializeSkeletonPose(upperArm);
+	initializeBlendTree();
+}
+
+// Replays a session with no window, as fast as it computes. A frame's work depends only on
+// the state, so it is repeated and the fastest run kept, and the same goes for the calibration
+// workload it is measured against.
+void runHeadlessReplay()
+{
+	while((unsigned int) frameNumber < replaySession->frames) {
+		replayInput();
+		double fastest = 1e30;
+		for(int r = 0; r < HEADLESS_REPEATS; r++) {
+			double start = nowSeconds();
+			updateFrame();
+			double elapsed = nowSeconds() - start;
+			if(elapsed < fastest) {
+				fastest = elapsed;
+			}
+		}
+		double calibration = 1e30;
+		for(int r = 0; r < HEADLESS_REPEATS; r++) {
+			double elapsed = timeCalibration();
+			if(elapsed < calibration) {
+				calibration = elapsed;
+			}
+		}
+		addChecksumVertices(frameTimes, &weightedMesh[0][0], 22 * 37);
+		addFrameTime(frameTimes, fastest, calibration);
+		frameNumber++;
+	}
+	finishReplay();
+}
+
+void printUsage(const char* program)
+{
+	printf("usage: %s [-record session] [-replay session [-headless] [-checksum file] [-baseline file]\n"
+		   "       [-write] [-threshold percent] [-frametimes file.csv]]\n", program);
+}
 
-	createBoneDLists(upperArm); // -5 wrt lowerArm's base
+// Returns false on an unknown or incomplete option
+bool parseArguments(int argc, char** argv)
+{
+	for(int i = 1; i < argc; i++) {
+		bool hasValue = i + 1 < argc;
+		if(strcmp(argv[i], "-record") == 0 && hasValue) {
+			recordPath = argv[++i];
+		} else if(strcmp(argv[i], "-replay") == 0 && hasValue) {
+			const char* path = argv[++i];
+			replaySession = loadInputSession(path);
+			if(replaySession == NULL) {
+				printf("could not read input session %s\n", path);
+				return false;
+			}
+		} else if(strcmp(argv[i], "-headless") == 0) {
+			headless = true;
+		} else if(strcmp(argv[i], "-checksum") == 0 && hasValue) {
+			checksumPath = argv[++i];
+		} else if(strcmp(argv[i], "-baseline") == 0 && hasValue) {
+			baselinePath = argv[++i];
+		} else if(strcmp(argv[i], "-write") == 0) {
+			writeBaseline = true;
+		} else if(strcmp(argv[i], "-threshold") == 0 && hasValue) {
+			regressionThreshold = atof(argv[++i]);
+		} else if(strcmp(argv[i], "-frametimes") == 0 && hasValue) {
+			frameTimesPath = argv[++i];
+		} else {
+			return false;
+		}
+	}
+	return replaySession != NULL || (!headless && checksumPath == NULL && baselinePath == NULL && frameTimesPath == NULL);
 }
 
 int main(int argc, char** argv)
 {
+	if(!parseArguments(argc, argv)) {
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(recordPath != NULL && replaySession == NULL) {
+		recording = createInputSession();
+		atexit(saveRecording);
+	}
+	if(replaySession != NULL) {
+		frameTimes = createFrameTimes(replaySession->frames);
+	}
+	if(headless) {
+		initializeSkeleton();
+		createElbowMorphTargets(11, 1.75f);
+		initializeAutoWeights();
+		runHeadlessReplay();
+	}
+
 	// initialize glut
     glutInit(&argc, argv);
     glutInitDisplayMode (GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
@@ -800,6 +1044,8 @@ int main(int argc, char** argv)
 	//initialize main stuff
     initializeGL();
     initializeSkeleton();
+    createElbowMorphTargets(11, 1.75f);
+    initializeAutoWeights();
 
     glutDisplayFunc(display); 
     glutIdleFunc(animate);